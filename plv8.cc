@@ -13,7 +13,10 @@
 
 #include "libplatform/libplatform.h"
 #include "plv8_allocator.h"
+#include "plv8_stats.h"
+#include "plv8_profile.h"
 
+#include <algorithm>
 #include <new>
 
 extern "C" {
@@ -21,29 +24,56 @@ extern "C" {
 #include "access/htup_details.h"
 #endif
 #include "access/xact.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_language.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
+#include "commands/proclang.h"
 #include "commands/trigger.h"
 #include "executor/spi.h"
 #include "funcapi.h"
+#include "lib/ilist.h"
+#include "lib/stringinfo.h"
 #include "miscadmin.h"
+#include "parser/scansup.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "utils/array.h"
+#include "utils/acl.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
+#include "utils/inval.h"
+#if PG_VERSION_NUM >= 90400
+#include "utils/jsonb.h"
+#endif
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 
 #if PG_VERSION_NUM >= 120000
 #include "catalog/pg_database.h"
 #endif
 
+#if PG_VERSION_NUM >= 100000
+#include "utils/varlena.h"
+#endif
+
 #if PG_VERSION_NUM >= 130000
 #include "common/hashfn.h"
 #endif
 
 #include <signal.h>
 
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+#ifndef HAVE_GETRUSAGE
+#include "rusagestub.h"
+#endif
+
 #ifdef EXECUTION_TIMEOUT
 #ifdef _MSC_VER
 #include <windows.h>
@@ -61,7 +91,18 @@ PGDLLEXPORT Datum	plcoffee_call_validator(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum	plls_call_handler(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum	plls_call_validator(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum	plv8_reset(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_reset_contexts(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum	plv8_info(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_context_stats(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_runtime_cache(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_function_cache(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_eval(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_warmup(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_es_modules_changed(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_runtime_stats(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_profile_start(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_profile_stop(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_profile_remove(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(plv8_call_handler);
 PG_FUNCTION_INFO_V1(plv8_call_validator);
@@ -70,7 +111,18 @@ PG_FUNCTION_INFO_V1(plcoffee_call_validator);
 PG_FUNCTION_INFO_V1(plls_call_handler);
 PG_FUNCTION_INFO_V1(plls_call_validator);
 PG_FUNCTION_INFO_V1(plv8_reset);
+PG_FUNCTION_INFO_V1(plv8_reset_contexts);
 PG_FUNCTION_INFO_V1(plv8_info);
+PG_FUNCTION_INFO_V1(plv8_context_stats);
+PG_FUNCTION_INFO_V1(plv8_runtime_cache);
+PG_FUNCTION_INFO_V1(plv8_function_cache);
+PG_FUNCTION_INFO_V1(plv8_eval);
+PG_FUNCTION_INFO_V1(plv8_warmup);
+PG_FUNCTION_INFO_V1(plv8_es_modules_changed);
+PG_FUNCTION_INFO_V1(plv8_runtime_stats);
+PG_FUNCTION_INFO_V1(plv8_profile_start);
+PG_FUNCTION_INFO_V1(plv8_profile_stop);
+PG_FUNCTION_INFO_V1(plv8_profile_remove);
 
 
 PGDLLEXPORT void _PG_init(void);
@@ -97,10 +149,19 @@ typedef struct plv8_proc_key {
 typedef struct plv8_proc_cache
 {
 	plv8_proc_key			key;
+	dlist_node				ctx_node;	/* in plv8_proc_context.procs */
+	dlist_node				lru_node;	/* in plv8_proc_lru while compiled */
+	dlist_node				hash_node;	/* in plv8_proc_hashvalue.procs */
 
 	Persistent<Function>	function;
+	struct plv8_exec_env   *xenv;		/* receiver, kept across transactions */
 	char					proname[NAMEDATALEN];
 	char				   *prosrc;
+	size_t					code_size;	/* estimated from prosrc */
+	bool					pinned;		/* never evicted */
+	bool					valid;		/* false once pg_proc row changed */
+	uint32					fn_hashvalue;	/* PROCOID syscache hash */
+	bool					fn_own;		/* pg_proc row written by this backend */
 
 	TransactionId			fn_xmin;
 	ItemPointerData			fn_tid;
@@ -111,6 +172,31 @@ typedef struct plv8_proc_cache
 	Oid						argtypes[FUNC_MAX_ARGS];
 } plv8_proc_cache;
 
+/*
+ * Index of plv8_proc_cache entries by user and context, so a context can be
+ * dropped without scanning the whole proc cache.
+ */
+typedef struct plv8_proc_context_key {
+	Oid user_id;
+	char user_ctx[NAMEDATALEN];
+} plv8_proc_context_key;
+
+typedef struct plv8_proc_context
+{
+	plv8_proc_context_key	key;
+	dlist_head				procs;
+} plv8_proc_context;
+
+/*
+ * Index of plv8_proc_cache entries by the PROCOID syscache hash value, so
+ * an invalidation only visits the entries of the function that changed.
+ */
+typedef struct plv8_proc_hashvalue
+{
+	uint32					hashvalue;
+	dlist_head				procs;
+} plv8_proc_hashvalue;
+
 plv8_runtime *current_runtime = nullptr;
 size_t plv8_memory_limit = 0;
 size_t plv8_last_heap_size = 0;
@@ -118,46 +204,150 @@ size_t plv8_last_heap_size = 0;
 /*
  * The function and context are created at the first invocation.  Their
  * lifetime is same as plv8_proc, but they are not palloc'ed memory,
- * so we need to clear them at the end of transaction.
+ * so we need to clear them at the end of transaction.  The receivers of
+ * functions are persistent instead, owned by their proc cache entry until
+ * it is released or a transaction aborts, then cleared along with the others.
  */
 typedef struct plv8_exec_env
 {
 	Isolate 			   *isolate;
 	Persistent<Object>		recv;
+	bool					persistent;	/* in TopMemoryContext */
+	uint32					abort_generation;	/* see plv8_abort_generation */
 	struct plv8_exec_env   *next;
 } plv8_exec_env;
 
 /*
  * We cannot cache plv8_type inter executions because it has FmgrInfo fields.
- * So, we cache rettype and argtype in fn_extra only during one execution.
+ * So, we cache rettype and argtype in fn_extra only during one execution,
+ * filled from the backend-wide type cache of plv8_fill_type.
+ * The runtime is cached along, valid as long as the user is the same and
+ * no runtime has been disposed of or reset since (see plv8_runtime_generation).
  */
 typedef struct plv8_proc
 {
 	plv8_proc_cache		   *cache;
 	plv8_exec_env		   *xenv;
+	plv8_runtime		   *runtime;
+	Oid						user_id;
+	uint32					runtime_generation;
 	TypeFuncClass			functypclass;			/* For SRF */
 	plv8_type				rettype;
 	plv8_type				argtypes[FUNC_MAX_ARGS];
 } plv8_proc;
 
 static HTAB *plv8_proc_cache_hash = NULL;
+static HTAB *plv8_proc_context_hash = NULL;
+static HTAB *plv8_proc_hashvalue_hash = NULL;
+
+/*
+ * Compiled functions, most recently used first.  Cold ones are released
+ * once there are more than plv8.function_cache_size of them or their
+ * source adds up to more than plv8.function_cache_budget.
+ */
+static dlist_head plv8_proc_lru = DLIST_STATIC_INIT(plv8_proc_lru);
+static size_t plv8_proc_lru_count = 0;
+static size_t plv8_proc_lru_size = 0;
+
+/* PROCOID hash values of cached functions invalidated since the last lookup */
+static std::vector<uint32> plv8_proc_changed;
+
+/* oids of plv8, plcoffee and plls, in the order of Dialect */
+#define PLV8_LANGUAGES 3
+static Oid plv8_lang_oids[PLV8_LANGUAGES];
+static bool plv8_lang_oids_valid = false;
+
+typedef struct plv8_find_function_entry
+{
+	std::string		search_path;	/* the signature was resolved with */
+	Oid				fn_oid;
+	bool			allowed;		/* EXECUTE privilege */
+	int				langno;			/* -1 if not a js function */
+} plv8_find_function_entry;
+
+/* see find_js_function_by_name(), keyed by "user:signature" */
+#define FIND_FUNCTION_CACHE_SIZE	1024
+static std::unordered_map<std::string, plv8_find_function_entry> FindFunctionCache;
+static uint32 plv8_find_function_generation = 0;
+static uint32 plv8_find_function_cache_generation = 0;
+
+/* bumped when plv8_es_modules changes, see plv8_runtime::compileModule() */
+static uint64 plv8_es_modules_generation = 0;
+static Oid plv8_es_modules_relid = InvalidOid;
+
+/* function cache counters, see plv8_function_cache() */
+static uint64 plv8_procs_evicted = 0;
+static uint64 plv8_proc_hits = 0;
+static uint64 plv8_proc_misses = 0;
 
 static plv8_exec_env		   *exec_env_head = NULL;
 
+/*
+ * Bumped when a top level transaction aborts.  The receivers created before
+ * are replaced on their next call, the values functions kept in them may
+ * come from the rolled back transaction.
+ */
+static uint32 plv8_abort_generation = 0;
+
+/*
+ * Isolate the validator checks the syntax of plv8 functions in.  It has a
+ * bare context and keeps nothing it compiled, so that creating functions
+ * neither runs plv8.start_proc nor fills the function cache.
+ */
+static Isolate					   *validator_isolate = nullptr;
+static ArrayBuffer::Allocator	   *validator_allocator = nullptr;
+static Persistent<Context>			validator_context;
+static bool							validator_isolate_dead = false;
+
 extern const unsigned char coffee_script_binary_data[];
 extern const unsigned char livescript_binary_data[];
 
+/*
+ * Compilation results shared by every runtime of the backend, keyed by a
+ * kind and the source: JS transpiled from CoffeeScript and LiveScript, and
+ * V8 code caches of functions.  The compilers are built in, so the dialect
+ * also identifies the compiler version.  Results of functions are dropped
+ * along with their pg_proc entries, as their source is unlikely to come
+ * back.
+ */
+typedef struct plv8_compile_entry
+{
+	std::string								data;
+	std::list<const std::string *>::iterator	lru;	/* position in CompileLRU */
+	uint32									fn_hashvalue;	/* 0 unless of a function */
+} plv8_compile_entry;
+
+static std::unordered_map<std::string, plv8_compile_entry> CompileCache;
+static std::list<const std::string *> CompileLRU;
+static size_t compile_cache_size = 0;
+static uint64 compile_cache_hits = 0;
+
+/* V8 code caches of the dialect compilers, so other runtimes skip parsing them */
+static std::string dialect_code_cache[PLV8_DIALECT_LIVESCRIPT + 1];
+static uint64 compiler_cache_hits = 0;
+static uint64 compiler_cache_rejected = 0;
+
 static void ClearProcCache(plv8_runtime *runtime, const char *context_id = nullptr);
+static void DropCompiled(uint32 fn_hashvalue);
 static void KillRuntime(plv8_runtime *runtime);
 static bool CheckTermination(Isolate *isolate);
+static void RecoverHeapLimit(plv8_runtime *runtime);
 
 /*
  * lower_case_functions are postgres-like C functions.
  * They could raise errors with elog/ereport(ERROR).
  */
+static plv8_proc *plv8_new_proc(plv8_proc_cache *cache, FunctionCallInfo fcinfo);
+static void plv8_proc_invalidate(Datum arg, int cacheid, uint32 hashvalue);
+static void plv8_find_function_invalidate(Datum arg, int cacheid, uint32 hashvalue);
+static void plv8_es_modules_invalidate(Datum arg, Oid relid);
+static char *plv8_module_source(const char *name);
 static plv8_proc *plv8_get_proc(Oid fn_oid, FunctionCallInfo fcinfo,
 		bool validate, char ***argnames) throw();
 static void plv8_xact_cb(XactEvent event, void *arg);
+static void InitializeV8();
+static void plv8_autowarm_save(int code, Datum arg);
+static void plv8_autowarm_load(std::vector<Oid> &oids);
 
 /*
  * CamelCaseFunctions are C++ functions.
@@ -165,20 +355,36 @@ static void plv8_xact_cb(XactEvent event, void *arg);
  */
 static plv8_exec_env *CreateExecEnv(Handle<Function> function, plv8_runtime *runtime);
 static plv8_exec_env *CreateExecEnv(Persistent<Function>& function, plv8_runtime *runtime);
+static plv8_exec_env *GetExecEnv(plv8_proc_cache *cache, plv8_runtime *runtime);
+static void InitExecEnv(plv8_exec_env *xenv, Local<Function> function, plv8_runtime *runtime);
 static plv8_proc *Compile(Oid fn_oid, FunctionCallInfo fcinfo,
-					bool validate, bool is_trigger, Dialect dialect);
+					bool validate, bool is_trigger, Dialect dialect,
+					bool eager = false);
 static Local<Function> CompileFunction(plv8_runtime *runtime,
 									   const char *proname, int proarglen,
 									   const char *proargs[], const char *prosrc,
-									   bool is_trigger, bool retset, Dialect dialect);
+									   bool is_trigger, bool retset, Dialect dialect,
+									   bool eager = false, uint32 fn_hashvalue = 0);
+static bool WarmFunction(Oid fn_oid);
+static void Autowarm();
+static MaybeLocal<Function> CompileFunctionBody(Local<Context> context, const char *proname,
+												int proarglen, const char *proargs[],
+												const char *prosrc, bool is_trigger,
+												bool eager, bool code_cache,
+												uint32 fn_hashvalue = 0);
+static void CheckFunctionSyntax(const char *proname, int proarglen, const char *proargs[],
+								const char *prosrc, bool is_trigger);
 static Datum CallFunction(PG_FUNCTION_ARGS, plv8_exec_env *xenv,
 		int nargs, plv8_type argtypes[], plv8_type *rettype);
 static Datum CallSRFunction(PG_FUNCTION_ARGS, plv8_exec_env *xenv,
 		int nargs, plv8_type argtypes[], plv8_type *rettype);
 static Datum CallTrigger(PG_FUNCTION_ARGS, plv8_exec_env *xenv);
 static plv8_runtime *GetPlv8Runtime();
+static plv8_runtime *ActivateRuntime(plv8_runtime *runtime);
+static Oid RuntimeOwner(Oid user_id);
 static Local<ObjectTemplate> GetGlobalObjectTemplate(plv8_runtime *runtime);
 static void CreateIsolate(plv8_runtime *runtime);
+static void IdleGC(plv8_runtime *runtime);
 
 /* A GUC to specify a custom start up function to call (superuser only) */
 static char *plv8_boot_proc = NULL;
@@ -202,19 +408,77 @@ static int plv8_execution_timeout = 300;
 /* A GUC to specify the user context LRU cache size (number of entries) */
 static size_t plv8_context_cache_size = 8;
 
+/* A GUC to specify the user context LRU cache size (MB of heap, 0 disables) */
+static int plv8_context_cache_budget = 0;
+
+/* GUCs to specify per user context quotas, 0 disables them */
+static int plv8_context_quota_interval = 60;
+static int plv8_context_cpu_soft_quota = 0;
+static int plv8_context_cpu_hard_quota = 0;
+static int plv8_context_heap_quota = 0;
+
+/* A GUC to collect plv8_context_stats without setting a CPU quota */
+static int plv8_track_contexts = 0;
+
+/* nesting of ContextCall, only the outermost call is accounted */
+static int context_call_depth = 0;
+
 /* A GUC to specify custom execution context */
 char *plv8_user_context = nullptr;
 
 /* A GUC to specify max code size for eval(), setting to -1 disables limits */
 static int plv8_max_eval_size = -1;
 
+/* GUCs for the work done at the first call after the backend was idle */
+static int plv8_idle_gc_time = 5;
+static int plv8_context_idle_timeout = 0;
+
 static std::unique_ptr<v8::Platform> v8_platform = NULL;
+static bool v8_initialized = false;	/* see InitializeV8() */
+
+/* GUCs to specify the compiled function LRU cache size, 0 is unlimited */
+static int plv8_function_cache_size = 0;
+static int plv8_function_cache_budget = 0;
+static int plv8_compile_cache_budget = 16;
+
+/* GUCs to specify the plv8.compile() and DO block cache size per runtime, budget 0 is unlimited */
+static int plv8_eval_cache_size = 1024;
+static int plv8_eval_cache_budget = 16;
+
+/* A GUC to specify functions that are never evicted from the cache */
+static char *plv8_pinned_functions = NULL;
+
+/*
+ * A GUC to specify how many of the most recently used functions are saved
+ * at backend exit and compiled on the first call of the next sessions, 0
+ * disables it.
+ */
+static int plv8_autowarm_size = 0;
+static bool autowarm_done = false;
+
+/* A GUC to specify the maximum number of isolates per backend, 0 is unlimited */
+static int plv8_max_isolates = 0;
 
 /*
- * We use vector instead of hash since the size of this array
- * is expected to be short in most cases.
+ * Runtimes of this backend, most recently used first, and indexed by
+ * user id.  Once plv8.max_isolates is reached the least recently used
+ * runtime that is not running any code is disposed of to make room.
  */
-static std::vector<plv8_runtime *> RuntimeCache;
+typedef std::list<plv8_runtime *> plv8_runtime_list;
+static plv8_runtime_list RuntimeCache;
+static std::unordered_map<Oid, plv8_runtime_list::iterator> RuntimeIndex;
+
+/* A GUC to specify roles sharing a single isolate */
+static char *plv8_shared_isolate_roles = NULL;
+
+/* bumped whenever a runtime or proc cache entries go away, invalidates plv8_proc */
+static uint32 plv8_runtime_generation = 0;
+
+/* runtime cache counters, see plv8_runtime_cache() */
+static uint64 plv8_runtimes_created = 0;
+static uint64 plv8_runtimes_evicted = 0;
+static uint64 plv8_runtime_hits = 0;
+static uint64 plv8_runtime_misses = 0;
 
 #ifdef ENABLE_DEBUGGER_SUPPORT
 v8::Persistent<v8::Context> debug_message_context;
@@ -242,6 +506,7 @@ void OOMErrorHandler(const char* location, bool is_heap_oom) {
 	isolate->TerminateExecution();
 	// set it to kill the whole user runtime
 	current_runtime->is_dead = true;
+	current_runtime->heap_limit_killed++;
 	// here lie the fattest dragons of the whole kingdom
 	// elog(ERROR, ...) will long jump over all the non-trivial destructors in V8
 	// which is _undefined behavior_
@@ -256,6 +521,8 @@ void GCEpilogueCallback(Isolate* isolate, GCType type, GCCallbackFlags /* flags
 	if (type != GCType::kGCTypeIncrementalMarking
 		&& heap_statistics.used_heap_size() > plv8_memory_limit * 1_MB) {
 		isolate->TerminateExecution();
+		if (current_runtime != nullptr && current_runtime->isolate == isolate)
+			current_runtime->heap_limit_hit = true;
 	}
 	if (heap_statistics.used_heap_size() > plv8_memory_limit * 1_MB / 0.9
 		&& plv8_last_heap_size < plv8_memory_limit * 1_MB / 0.9) {
@@ -264,13 +531,50 @@ void GCEpilogueCallback(Isolate* isolate, GCType type, GCCallbackFlags /* flags
 	plv8_last_heap_size = heap_statistics.used_heap_size();
 }
 
+static const double gc_pause_bounds[PLV8_GC_PAUSE_BUCKETS - 1] = {1, 2, 5, 10, 20, 50, 100};
+
+void GCPrologueStats(Isolate* /* isolate */, GCType /* type */, GCCallbackFlags /* flags */, void* data) {
+	plv8_runtime *runtime = (plv8_runtime *) data;
+	runtime->gc_stats.pause_start = v8_platform->MonotonicallyIncreasingTime();
+}
+
+void GCEpilogueStats(Isolate* /* isolate */, GCType type, GCCallbackFlags /* flags */, void* data) {
+	plv8_gc_stats *stats = &((plv8_runtime *) data)->gc_stats;
+	double pause = (v8_platform->MonotonicallyIncreasingTime() - stats->pause_start) * 1000.0;
+	int bucket = 0;
+
+	switch (type)
+	{
+	case GCType::kGCTypeScavenge:
+		stats->scavenges++;
+		break;
+	case GCType::kGCTypeMarkSweepCompact:
+		stats->mark_compacts++;
+		break;
+	case GCType::kGCTypeIncrementalMarking:
+		stats->incremental_steps++;
+		break;
+	default:
+		break;
+	}
+	stats->total_time += pause;
+	if (pause > stats->max_pause)
+		stats->max_pause = pause;
+	while (bucket < PLV8_GC_PAUSE_BUCKETS - 1 && pause > gc_pause_bounds[bucket])
+		bucket++;
+	stats->pauses[bucket]++;
+}
+
 size_t NearHeapLimitHandler(void* data, size_t current_heap_limit,
 								size_t initial_heap_limit) {
-	Isolate *isolate = Isolate::GetCurrent();
-	isolate->TerminateExecution();
-	// need to give back more space
-	// to make sure it can unwind the stack and process exceptions
-	return current_heap_limit + 1_MB;
+	plv8_runtime *runtime = (plv8_runtime *) data;
+	runtime->isolate->TerminateExecution();
+	// give back enough space to unwind the stack and process exceptions,
+	// the limit is restored by RecoverHeapLimit() once the call is gone
+	runtime->heap_limit_hit = true;
+	runtime->heap_limit_raised = true;
+	runtime->initial_heap_limit = initial_heap_limit;
+	return current_heap_limit + initial_heap_limit / 4;
 }
 
 ModifyCodeGenerationFromStringsResult CodeGenCallback(Local<Context> /* context */, Local<v8::Value> source) {
@@ -289,6 +593,8 @@ static void
 CreateIsolate(plv8_runtime *runtime) {
 	Isolate *isolate;
 	Isolate::CreateParams params;
+
+	InitializeV8();
 	params.array_buffer_allocator = new ArrayAllocator(plv8_memory_limit * 1_MB);
 	ResourceConstraints rc;
 	rc.ConfigureDefaults(plv8_memory_limit * 1_MB * 2, plv8_memory_limit * 1_MB * 2);
@@ -296,7 +602,9 @@ CreateIsolate(plv8_runtime *runtime) {
 	isolate = Isolate::New(params);
 	isolate->SetOOMErrorHandler(OOMErrorHandler);
 	isolate->AddGCEpilogueCallback(GCEpilogueCallback);
-	isolate->AddNearHeapLimitCallback(NearHeapLimitHandler, NULL);
+	isolate->AddGCPrologueCallback(GCPrologueStats, runtime);
+	isolate->AddGCEpilogueCallback(GCEpilogueStats, runtime);
+	isolate->AddNearHeapLimitCallback(NearHeapLimitHandler, runtime);
 	if (plv8_max_eval_size >= 0)
 		isolate->SetModifyCodeGenerationFromStringsCallback(CodeGenCallback);
 	runtime->isolate = isolate;
@@ -311,7 +619,7 @@ user_context_check_hook(char **newvalue, void **extra, GucSource source)
 		GUC_check_errdetail("user context id is too long, max %d characters", (NAMEDATALEN - 1));
 		return false;
 	}
-	else if (Isolate::GetCurrent() != nullptr && Isolate::GetCurrent()->IsInUse())
+	else if (v8_initialized && Isolate::GetCurrent() != nullptr && Isolate::GetCurrent()->IsInUse())
 	{
 		GUC_check_errdetail("cannot set context from inside a running transaction");
 		return false;
@@ -329,6 +637,24 @@ _PG_init(void)
 	plv8_proc_cache_hash = hash_create("PLv8 Procedures", 32,
 									   &hash_ctl, HASH_ELEM | HASH_BLOBS);
 
+	hash_ctl.keysize = sizeof(plv8_proc_context_key);
+	hash_ctl.entrysize = sizeof(plv8_proc_context);
+	plv8_proc_context_hash = hash_create("PLv8 Procedure Contexts", 16,
+										 &hash_ctl, HASH_ELEM | HASH_BLOBS);
+
+	hash_ctl.keysize = sizeof(uint32);
+	hash_ctl.entrysize = sizeof(plv8_proc_hashvalue);
+	plv8_proc_hashvalue_hash = hash_create("PLv8 Procedure Hash Values", 32,
+										   &hash_ctl, HASH_ELEM | HASH_BLOBS);
+	CacheRegisterSyscacheCallback(PROCOID, plv8_proc_invalidate, (Datum) 0);
+	CacheRegisterSyscacheCallback(PROCOID, plv8_find_function_invalidate, (Datum) 0);
+	CacheRegisterSyscacheCallback(LANGOID, plv8_find_function_invalidate, (Datum) 0);
+	CacheRegisterSyscacheCallback(NAMESPACEOID, plv8_find_function_invalidate, (Datum) 0);
+	CacheRegisterSyscacheCallback(AUTHOID, plv8_find_function_invalidate, (Datum) 0);
+	CacheRegisterSyscacheCallback(AUTHMEMROLEMEM, plv8_find_function_invalidate, (Datum) 0);
+	CacheRegisterSyscacheCallback(AUTHMEMROLEMEM, plv8_find_function_invalidate, (Datum) 0);
+	CacheRegisterRelcacheCallback(plv8_es_modules_invalidate, (Datum) 0);
+
 	config_generic *guc_value;
 
 #define BOOT_PROC_VAR "plv8.boot_proc"
@@ -508,6 +834,123 @@ _PG_init(void)
 	}
 #undef USER_CONTEXT_SIZE_VAR
 
+#define USER_CONTEXT_BUDGET_VAR "plv8.context_cache_budget"
+	guc_value = plv8_find_option(USER_CONTEXT_BUDGET_VAR);
+	if (guc_value != NULL) {
+		plv8_context_cache_budget = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(USER_CONTEXT_BUDGET_VAR,
+								gettext_noop("Heap size in MBytes of the live contexts in user context cache"),
+								gettext_noop("The default is 0 (disabled). "
+											 "The cache will evict and destroy contexts (using LRU) while their "
+											 "last measured heap size adds up to more than this"),
+								&plv8_context_cache_budget,
+								0, 0, 3096,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef USER_CONTEXT_BUDGET_VAR
+
+#define CONTEXT_QUOTA_INTERVAL_VAR "plv8.context_quota_interval"
+	guc_value = plv8_find_option(CONTEXT_QUOTA_INTERVAL_VAR);
+	if (guc_value != NULL) {
+		plv8_context_quota_interval = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(CONTEXT_QUOTA_INTERVAL_VAR,
+								gettext_noop("Interval in seconds the context CPU quotas apply to"),
+								gettext_noop("The default is 60 seconds"),
+								&plv8_context_quota_interval,
+								60, 1, 86400,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef CONTEXT_QUOTA_INTERVAL_VAR
+
+#define CONTEXT_CPU_SOFT_QUOTA_VAR "plv8.context_cpu_soft_quota"
+	guc_value = plv8_find_option(CONTEXT_CPU_SOFT_QUOTA_VAR);
+	if (guc_value != NULL) {
+		plv8_context_cpu_soft_quota = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(CONTEXT_CPU_SOFT_QUOTA_VAR,
+								gettext_noop("CPU time in ms a user context can use per interval before it is throttled"),
+								gettext_noop("The default is 0 (disabled). "
+											 "Over it, calls in the context wait for twice the CPU time of its last call"),
+								&plv8_context_cpu_soft_quota,
+								0, 0, INT_MAX,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef CONTEXT_CPU_SOFT_QUOTA_VAR
+
+#define CONTEXT_CPU_HARD_QUOTA_VAR "plv8.context_cpu_hard_quota"
+	guc_value = plv8_find_option(CONTEXT_CPU_HARD_QUOTA_VAR);
+	if (guc_value != NULL) {
+		plv8_context_cpu_hard_quota = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(CONTEXT_CPU_HARD_QUOTA_VAR,
+								gettext_noop("CPU time in ms a user context can use per interval before its calls fail"),
+								gettext_noop("The default is 0 (disabled)"),
+								&plv8_context_cpu_hard_quota,
+								0, 0, INT_MAX,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef CONTEXT_CPU_HARD_QUOTA_VAR
+
+#define CONTEXT_HEAP_QUOTA_VAR "plv8.context_heap_quota"
+	guc_value = plv8_find_option(CONTEXT_HEAP_QUOTA_VAR);
+	if (guc_value != NULL) {
+		plv8_context_heap_quota = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(CONTEXT_HEAP_QUOTA_VAR,
+								gettext_noop("Heap size in MBytes of a user context before it is evicted"),
+								gettext_noop("The default is 0 (disabled)"),
+								&plv8_context_heap_quota,
+								0, 0, 3096,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef CONTEXT_HEAP_QUOTA_VAR
+
+#define TRACK_CONTEXTS_VAR "plv8.track_contexts"
+	guc_value = plv8_find_option(TRACK_CONTEXTS_VAR);
+	if (guc_value != NULL) {
+		plv8_track_contexts = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(TRACK_CONTEXTS_VAR,
+								gettext_noop("Collects call statistics of user contexts, see plv8_context_stats"),
+								gettext_noop("The default is 0 (disabled), contexts are also accounted while a CPU quota is set"),
+								&plv8_track_contexts,
+								0, 0, 1,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef TRACK_CONTEXTS_VAR
+
 #define MAX_EVAL_SIZE_VAR "plv8.max_eval_size"
 	guc_value = plv8_find_option(MAX_EVAL_SIZE_VAR);
 	if (guc_value != NULL) {
@@ -528,262 +971,2022 @@ _PG_init(void)
 	}
 #undef MAX_EVAL_SIZE_VAR
 
-	RegisterXactCallback(plv8_xact_cb, NULL);
+#define IDLE_GC_TIME_VAR "plv8.idle_gc_time"
+	guc_value = plv8_find_option(IDLE_GC_TIME_VAR);
+	if (guc_value != NULL) {
+		plv8_idle_gc_time = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(IDLE_GC_TIME_VAR,
+								gettext_noop("Time in ms V8 can spend on garbage collection after the backend was idle"),
+								gettext_noop("The default is 5 ms, 0 disables it. Runs at the first call after "
+											 "the backend was idle, once the heap grew by 1MB since the last time"),
+								&plv8_idle_gc_time,
+								5, 0, 1000,
+								PGC_USERSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef IDLE_GC_TIME_VAR
 
-	EmitWarningsOnPlaceholders("plv8");
+#define CONTEXT_IDLE_TIMEOUT_VAR "plv8.context_idle_timeout"
+	guc_value = plv8_find_option(CONTEXT_IDLE_TIMEOUT_VAR);
+	if (guc_value != NULL) {
+		plv8_context_idle_timeout = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(CONTEXT_IDLE_TIMEOUT_VAR,
+								gettext_noop("Disposes of user contexts unused for this many seconds"),
+								gettext_noop("The default is 0 (disabled), checked at the first call "
+											 "after the backend was idle"),
+								&plv8_context_idle_timeout,
+								0, 0, INT_MAX,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef CONTEXT_IDLE_TIMEOUT_VAR
 
-	if (plv8_icu_data == NULL) {
-		elog(DEBUG1, "no icu dir");
-		V8::InitializeICU();
+#define FUNCTION_CACHE_SIZE_VAR "plv8.function_cache_size"
+	guc_value = plv8_find_option(FUNCTION_CACHE_SIZE_VAR);
+	if (guc_value != NULL) {
+		plv8_function_cache_size = plv8_int_option(guc_value);
 	} else {
-		elog(DEBUG1, "init icu data %s", plv8_icu_data);
-		V8::InitializeICU(plv8_icu_data);
+		DefineCustomIntVariable(FUNCTION_CACHE_SIZE_VAR,
+								gettext_noop("Maximum number of compiled functions kept by a backend"),
+								gettext_noop("The default is 0 (unlimited). The least recently used "
+											 "functions are released and compiled again on their next call"),
+								&plv8_function_cache_size,
+								0, 0, INT_MAX,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
 	}
+#undef FUNCTION_CACHE_SIZE_VAR
 
-#if (V8_MAJOR_VERSION == 4 && V8_MINOR_VERSION >= 6) || V8_MAJOR_VERSION >= 5
-	V8::InitializeExternalStartupData("plv8");
+#define FUNCTION_CACHE_BUDGET_VAR "plv8.function_cache_budget"
+	guc_value = plv8_find_option(FUNCTION_CACHE_BUDGET_VAR);
+	if (guc_value != NULL) {
+		plv8_function_cache_budget = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(FUNCTION_CACHE_BUDGET_VAR,
+								gettext_noop("Source size in MB of the compiled functions kept by a backend"),
+								gettext_noop("The default is 0 (unlimited). The least recently used "
+											 "functions are released and compiled again on their next call"),
+								&plv8_function_cache_budget,
+								0, 0, 1024,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
 #endif
-	if (!v8_platform) {
-		v8_platform = platform::NewDefaultPlatform();
+								NULL,
+								NULL);
 	}
-	V8::InitializePlatform(v8_platform.get());
-	V8::Initialize();
-	if (plv8_v8_flags != NULL) {
-		V8::SetFlagsFromString(plv8_v8_flags, strlen(plv8_v8_flags));
+#undef FUNCTION_CACHE_BUDGET_VAR
+
+#define COMPILE_CACHE_BUDGET_VAR "plv8.compile_cache_budget"
+	guc_value = plv8_find_option(COMPILE_CACHE_BUDGET_VAR);
+	if (guc_value != NULL) {
+		plv8_compile_cache_budget = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(COMPILE_CACHE_BUDGET_VAR,
+								gettext_noop("Size in MB of the transpiled dialect code and V8 code caches kept by a backend"),
+								gettext_noop("The default is 16, 0 means unlimited. The least recently used "
+											 "results are released first"),
+								&plv8_compile_cache_budget,
+								16, 0, 1024,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
 	}
-}
+#undef COMPILE_CACHE_BUDGET_VAR
 
-static void
-plv8_xact_cb(XactEvent event, void *arg)
-{
-	plv8_exec_env	   *env = exec_env_head;
+#define PINNED_FUNCTIONS_VAR "plv8.pinned_functions"
+	guc_value = plv8_find_option(PINNED_FUNCTIONS_VAR);
+	if (guc_value != NULL) {
+		plv8_pinned_functions = plv8_string_option(guc_value);
+	} else {
+		DefineCustomStringVariable(PINNED_FUNCTIONS_VAR,
+								   gettext_noop("Comma separated list of functions never evicted from the function cache."),
+								   NULL,
+								   &plv8_pinned_functions,
+								   NULL,
+								   PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								   NULL,
+#endif
+								   NULL,
+								   NULL);
+	}
+#undef PINNED_FUNCTIONS_VAR
 
-	while (env)
-	{
-		if (!env->recv.IsEmpty())
-		{
-			env->recv.Reset();
-		}
-		env = env->next;
-		/*
-		 * Each item was allocated in TopTransactionContext, so
-		 * it will be freed eventually.
-		 */
+#define EVAL_CACHE_SIZE_VAR "plv8.eval_cache_size"
+	guc_value = plv8_find_option(EVAL_CACHE_SIZE_VAR);
+	if (guc_value != NULL) {
+		plv8_eval_cache_size = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(EVAL_CACHE_SIZE_VAR,
+								gettext_noop("Maximum number of DO blocks and functions compiled by plv8.compile() and plv8_eval() kept by a runtime"),
+								gettext_noop("The default is 1024, 0 disables the cache. The least recently used "
+											 "functions are released and compiled again on their next use"),
+								&plv8_eval_cache_size,
+								1024, 0, INT_MAX,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
 	}
-	exec_env_head = NULL;
-}
+#undef EVAL_CACHE_SIZE_VAR
 
-static inline plv8_exec_env *
-plv8_new_exec_env(Isolate *isolate)
-{
-	plv8_exec_env	   *xenv = (plv8_exec_env *)
-		MemoryContextAllocZero(TopTransactionContext, sizeof(plv8_exec_env));
+#define EVAL_CACHE_BUDGET_VAR "plv8.eval_cache_budget"
+	guc_value = plv8_find_option(EVAL_CACHE_BUDGET_VAR);
+	if (guc_value != NULL) {
+		plv8_eval_cache_budget = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(EVAL_CACHE_BUDGET_VAR,
+								gettext_noop("Source size in MB of the DO blocks and functions compiled by plv8.compile() and plv8_eval() kept by a runtime"),
+								gettext_noop("The default is 16 MB, 0 is unlimited"),
+								&plv8_eval_cache_budget,
+								16, 0, 1024,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef EVAL_CACHE_BUDGET_VAR
 
-	new(&xenv->recv) Persistent<Object>();
-	xenv->isolate = isolate;
+#define AUTOWARM_SIZE_VAR "plv8.autowarm_size"
+	guc_value = plv8_find_option(AUTOWARM_SIZE_VAR);
+	if (guc_value != NULL) {
+		plv8_autowarm_size = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(AUTOWARM_SIZE_VAR,
+								gettext_noop("Number of most recently used functions saved at backend exit and compiled ahead of the first call of new sessions"),
+								gettext_noop("The default is 0 (disabled)"),
+								&plv8_autowarm_size,
+								0, 0, 10000,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef AUTOWARM_SIZE_VAR
 
-	/*
-	 * Add it to the list, which will be freed in the end of top transaction.
-	 */
-	xenv->next = exec_env_head;
-	exec_env_head = xenv;
+#define TRACK_FUNCTIONS_VAR "plv8.track_functions"
+	guc_value = plv8_find_option(TRACK_FUNCTIONS_VAR);
+	if (guc_value != NULL) {
+		plv8_track_functions = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(TRACK_FUNCTIONS_VAR,
+								gettext_noop("Collects call statistics of plv8 functions, see pg_stat_plv8_functions"),
+								gettext_noop("The default is 0 (disabled), needs plv8 in shared_preload_libraries"),
+								&plv8_track_functions,
+								0, 0, 1,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef TRACK_FUNCTIONS_VAR
 
-	return xenv;
-}
+#define STATS_MAX_FUNCTIONS_VAR "plv8.stats_max_functions"
+	guc_value = plv8_find_option(STATS_MAX_FUNCTIONS_VAR);
+	if (guc_value != NULL) {
+		plv8_stats_max_functions = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(STATS_MAX_FUNCTIONS_VAR,
+								gettext_noop("Maximum number of functions with statistics in shared memory"),
+								NULL,
+								&plv8_stats_max_functions,
+								5000, 100, INT_MAX,
+								PGC_POSTMASTER, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef STATS_MAX_FUNCTIONS_VAR
+
+#define PROFILE_MIN_DURATION_VAR "plv8.profile_min_duration"
+	guc_value = plv8_find_option(PROFILE_MIN_DURATION_VAR);
+	if (guc_value != NULL) {
+		plv8_profile_min_duration = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(PROFILE_MIN_DURATION_VAR,
+								gettext_noop("Saves CPU profiles of plv8 function calls taking at least this many ms"),
+								gettext_noop("The default is 0 (disabled), profiles are saved in plv8_profiles"),
+								&plv8_profile_min_duration,
+								0, 0, INT_MAX,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef PROFILE_MIN_DURATION_VAR
+
+#define PROFILE_INTERVAL_VAR "plv8.profile_interval"
+	guc_value = plv8_find_option(PROFILE_INTERVAL_VAR);
+	if (guc_value != NULL) {
+		plv8_profile_interval = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(PROFILE_INTERVAL_VAR,
+								gettext_noop("Sampling interval in microseconds of the profiles of plv8.profile_min_duration"),
+								NULL,
+								&plv8_profile_interval,
+								1000, 50, 1000000,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef PROFILE_INTERVAL_VAR
+
+#define PROFILE_MAX_FILES_VAR "plv8.profile_max_files"
+	guc_value = plv8_find_option(PROFILE_MAX_FILES_VAR);
+	if (guc_value != NULL) {
+		plv8_profile_max_files = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(PROFILE_MAX_FILES_VAR,
+								gettext_noop("Maximum number of profiles of plv8.profile_min_duration kept in plv8_profiles"),
+								gettext_noop("The default is 100, 0 means unlimited. The oldest profiles are "
+											 "removed first"),
+								&plv8_profile_max_files,
+								100, 0, INT_MAX,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef PROFILE_MAX_FILES_VAR
+
+#define SHARED_ISOLATE_ROLES_VAR "plv8.shared_isolate_roles"
+	guc_value = plv8_find_option(SHARED_ISOLATE_ROLES_VAR);
+	if (guc_value != NULL) {
+		plv8_shared_isolate_roles = plv8_string_option(guc_value);
+	} else {
+		DefineCustomStringVariable(SHARED_ISOLATE_ROLES_VAR,
+								   gettext_noop("Comma separated list of roles sharing a single isolate."),
+								   gettext_noop("Superuser only, the roles see each other's global objects"),
+								   &plv8_shared_isolate_roles,
+								   NULL,
+								   PGC_SUSET, GUC_SUPERUSER_ONLY,
+#if PG_VERSION_NUM >= 90100
+								   NULL,
+#endif
+								   NULL,
+								   NULL);
+	}
+#undef SHARED_ISOLATE_ROLES_VAR
+
+#define MAX_ISOLATES_VAR "plv8.max_isolates"
+	guc_value = plv8_find_option(MAX_ISOLATES_VAR);
+	if (guc_value != NULL) {
+		plv8_max_isolates = plv8_int_option(guc_value);
+	} else {
+		DefineCustomIntVariable(MAX_ISOLATES_VAR,
+								gettext_noop("Maximum number of isolates kept by a backend"),
+								gettext_noop("The default is 0 (unlimited). When the limit is reached, "
+											 "the least recently used isolate is disposed of to make room for a new one"),
+								&plv8_max_isolates,
+								0, 0, 1024,
+								PGC_SUSET, 0,
+#if PG_VERSION_NUM >= 90100
+								NULL,
+#endif
+								NULL,
+								NULL);
+	}
+#undef MAX_ISOLATES_VAR
+
+	RegisterXactCallback(plv8_xact_cb, NULL);
+
+	EmitWarningsOnPlaceholders("plv8");
+
+	plv8_stats_init();
+
+	/*
+	 * Preloaded in the postmaster, V8 is initialized by each backend on
+	 * first use instead, as its platform threads don't survive fork().
+	 */
+	if (!process_shared_preload_libraries_in_progress)
+		InitializeV8();
+}
+
+/*
+ * Initialize V8 once per backend, before the first isolate is created.
+ */
+static void
+InitializeV8()
+{
+	if (v8_initialized)
+		return;
+	v8_initialized = true;
+
+	// on_proc_exit callbacks of the postmaster are reset in its children
+	on_proc_exit(plv8_autowarm_save, (Datum) 0);
+
+	if (plv8_icu_data == NULL) {
+		elog(DEBUG1, "no icu dir");
+		V8::InitializeICU();
+	} else {
+		elog(DEBUG1, "init icu data %s", plv8_icu_data);
+		V8::InitializeICU(plv8_icu_data);
+	}
+
+#if (V8_MAJOR_VERSION == 4 && V8_MINOR_VERSION >= 6) || V8_MAJOR_VERSION >= 5
+	V8::InitializeExternalStartupData("plv8");
+#endif
+	if (!v8_platform) {
+		v8_platform = platform::NewDefaultPlatform();
+	}
+	V8::InitializePlatform(v8_platform.get());
+	V8::Initialize();
+	if (plv8_v8_flags != NULL) {
+		V8::SetFlagsFromString(plv8_v8_flags, strlen(plv8_v8_flags));
+	}
+}
+
+static void
+plv8_xact_cb(XactEvent event, void *arg)
+{
+	plv8_exec_env	   *env = exec_env_head;
+
+	while (env)
+	{
+		plv8_exec_env	   *next = env->next;
+
+		if (!env->recv.IsEmpty())
+		{
+			env->recv.Reset();
+		}
+		/*
+		 * Each item was allocated in TopTransactionContext, so
+		 * it will be freed eventually, except for the receivers
+		 * released from the proc cache.
+		 */
+		if (env->persistent)
+			pfree(env);
+		env = next;
+	}
+	exec_env_head = NULL;
+
+	/*
+	 * The backend may go idle once a top level transaction ends.  Note when
+	 * for IdleGC(), run by the next call rather than before the client gets
+	 * its reply, and don't keep the transaction's peak ArrayBuffer usage
+	 * cached forever.
+	 */
+	if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT)
+	{
+		plv8_stats_flush(event == XACT_EVENT_ABORT);
+		// elog(ERROR) may have jumped over the destructors of ContextCall
+		if (event == XACT_EVENT_ABORT)
+		{
+			context_call_depth = 0;
+			plv8_abort_generation++;
+		}
+		for (auto runtime: RuntimeCache)
+		{
+			if (runtime->reset_pending && !runtime->wasKilled())
+				runtime->resetContexts();
+			if (runtime->idle_gc)
+			{
+				runtime->idle_since = GetCurrentTimestamp();
+				runtime->idle_gc = false;
+			}
+			static_cast<ArrayAllocator *>(runtime->array_buffer_allocator)->TrimPool(ARRAY_POOL_KEEP);
+		}
+	}
+}
+
+/*
+ * Receives the heap size of each user context from Isolate::MeasureMemory().
+ * The result is delivered by a platform task, so only when we pump the
+ * message loop in MeasureContexts().
+ */
+class ContextMeasurement : public MeasureMemoryDelegate
+{
+private:
+	plv8_runtime   *m_runtime;
+
+public:
+	explicit ContextMeasurement(plv8_runtime *runtime) : m_runtime(runtime) {}
+
+	bool ShouldMeasure(Local<Context> context) override
+	{
+		return true;
+	}
+
+	void MeasurementComplete(const std::vector<std::pair<Local<Context>, size_t>>& context_sizes_in_bytes,
+							 size_t unattributed_size_in_bytes) override
+	{
+		Isolate	   *isolate = m_runtime->isolate;
+
+		for (auto &it: m_runtime->ctx_queue)
+		{
+			Local<Context>	context = std::get<1>(it).Get(isolate);
+
+			for (auto &size: context_sizes_in_bytes)
+			{
+				if (size.first == context)
+				{
+					std::get<2>(it) = size.second;
+					break;
+				}
+			}
+		}
+		m_runtime->measure_pending = false;
+	}
+};
+
+/*
+ * Collect the last context measurement and start the next one.  The
+ * measurement is taken during V8's next GC rather than forcing one.
+ */
+static void
+MeasureContexts(plv8_runtime *runtime)
+{
+	Isolate	   *isolate = runtime->isolate;
+
+	while (platform::PumpMessageLoop(v8_platform.get(), isolate))
+		continue;
+
+	runtime->evictContexts(0);
+
+	if (!runtime->measure_pending && !runtime->ctx_queue.empty())
+	{
+		runtime->measure_pending = true;
+		isolate->MeasureMemory(std::unique_ptr<MeasureMemoryDelegate>(new ContextMeasurement(runtime)),
+							   MeasureMemoryExecution::kDefault);
+	}
+}
+
+/* heap growth since the last IdleGC() worth collecting */
+#define IDLE_GC_MIN_GROWTH		1_MB
+
+/* time in ms between transactions using a runtime for the backend to count as idle */
+#define IDLE_GC_MIN_IDLE		100
+
+/*
+ * Work put off while the backend was idle, done by the first call of a
+ * runtime starting at least IDLE_GC_MIN_IDLE ms after the last transaction
+ * using it ended.  Postgres has no hook for the backend waiting for the
+ * next command, and V8 cannot run from a timeout handler, so it happens
+ * here rather than before the client gets its reply to a COMMIT.
+ *
+ * User contexts unused for plv8.context_idle_timeout are disposed of,
+ * except the one the call is about to use, and counted as evicted.  Then,
+ * if the heap grew noticeably since the last time, moderate memory pressure
+ * starts incremental marking, which V8 advances or finishes in up to
+ * plv8.idle_gc_time ms.
+ */
+static void
+IdleGC(plv8_runtime *runtime)
+{
+	Isolate		   *isolate = runtime->isolate;
+	TimestampTz		idle_since = runtime->idle_since;
+	TimestampTz		now = GetCurrentStatementStartTimestamp();
+
+	runtime->idle_since = 0;
+	// e.g. COMMIT inside a procedure, JS is still on the stack
+	if (isolate->IsInUse() || runtime->wasKilled() ||
+		!TimestampDifferenceExceeds(idle_since, now, IDLE_GC_MIN_IDLE))
+		return;
+
+	Isolate::Scope	scope(isolate);
+	HandleScope		handle_scope(isolate);
+
+	if (plv8_context_idle_timeout > 0)
+	{
+		TimestampTz					stale = now - (TimestampTz) plv8_context_idle_timeout * USECS_PER_SEC;
+		const char				   *current = plv8_user_context != nullptr ? plv8_user_context : "";
+		std::vector<std::string>	idle;
+
+		for (auto &it: runtime->ctx_queue)
+		{
+			if (std::get<3>(it) < stale && std::get<0>(it) != current)
+				idle.push_back(std::get<0>(it));
+		}
+		for (auto &key: idle)
+		{
+			runtime->ctx_stats[key].evicted++;
+			runtime->removeContext(key.c_str());
+		}
+	}
+
+	if (plv8_idle_gc_time > 0)
+	{
+		HeapStatistics	heap_statistics;
+
+		isolate->GetHeapStatistics(&heap_statistics);
+		if (heap_statistics.used_heap_size() < runtime->idle_gc_heap)
+			runtime->idle_gc_heap = heap_statistics.used_heap_size();
+		else if (heap_statistics.used_heap_size() - runtime->idle_gc_heap >= IDLE_GC_MIN_GROWTH)
+		{
+			isolate->MemoryPressureNotification(MemoryPressureLevel::kModerate);
+			isolate->IdleNotificationDeadline(v8_platform->MonotonicallyIncreasingTime() +
+											  plv8_idle_gc_time / 1000.0);
+			isolate->GetHeapStatistics(&heap_statistics);
+			runtime->idle_gc_heap = heap_statistics.used_heap_size();
+		}
+	}
+	MeasureContexts(runtime);
+}
+
+static inline plv8_exec_env *
+plv8_new_exec_env(Isolate *isolate)
+{
+	plv8_exec_env	   *xenv = (plv8_exec_env *)
+		MemoryContextAllocZero(TopTransactionContext, sizeof(plv8_exec_env));
+
+	new(&xenv->recv) Persistent<Object>();
+	xenv->isolate = isolate;
+
+	/*
+	 * Add it to the list, which will be freed in the end of top transaction.
+	 */
+	xenv->next = exec_env_head;
+	exec_env_head = xenv;
+
+	return xenv;
+}
 
 static Datum
 common_pl_call_handler(PG_FUNCTION_ARGS, Dialect dialect) throw()
 {
-	Oid		fn_oid = fcinfo->flinfo->fn_oid;
-	bool	is_trigger = CALLED_AS_TRIGGER(fcinfo);
+	Oid		fn_oid = fcinfo->flinfo->fn_oid;
+	bool	is_trigger = CALLED_AS_TRIGGER(fcinfo);
+
+	try
+	{
+		plv8_proc	   *proc = (plv8_proc *) fcinfo->flinfo->fn_extra;
+		Oid				user_id = GetUserId();
+
+		/*
+		 * Nested calls through SECURITY DEFINER functions switch users back
+		 * and forth, reuse the runtime the function was called with last
+		 * time instead of looking it up again.  If the user changed, the
+		 * function has to be compiled in the other user's runtime.
+		 */
+		if (proc != nullptr && proc->user_id == user_id &&
+			proc->runtime_generation == plv8_runtime_generation &&
+			!proc->runtime->wasKilled())
+		{
+			current_runtime = ActivateRuntime(proc->runtime);
+			// IdleGC() or evicting contexts may have released the function
+			if (proc->runtime_generation != plv8_runtime_generation)
+				proc = nullptr;
+		}
+		else
+		{
+			current_runtime = GetPlv8Runtime();
+			if (proc != nullptr &&
+				(proc->runtime_generation != plv8_runtime_generation ||
+				 proc->runtime != current_runtime))
+				proc = nullptr;
+		}
+#ifdef ENABLE_DEBUGGER_SUPPORT
+		Locker				lock;
+#endif  // ENABLE_DEBUGGER_SUPPORT
+		Isolate::Scope	scope(current_runtime->isolate);
+		HandleScope	handle_scope(current_runtime->isolate);
+
+		if (proc == nullptr)
+		{
+			if (!autowarm_done)
+				Autowarm();
+			proc = Compile(fn_oid, fcinfo, false, is_trigger, dialect);
+			proc->xenv = GetExecEnv(proc->cache, current_runtime);
+			proc->runtime = current_runtime;
+			fcinfo->flinfo->fn_extra = proc;
+		}
+		proc->user_id = user_id;
+		proc->runtime_generation = plv8_runtime_generation;
+
+		plv8_proc_cache *cache = proc->cache;
+		FunctionStats	stats(fn_oid);
+		CallProfile		profile(current_runtime, fn_oid, cache->proname);
+		Datum			result;
+
+		if (is_trigger)
+			result = CallTrigger(fcinfo, proc->xenv);
+		else if (cache->retset)
+			result = CallSRFunction(fcinfo, proc->xenv,
+						cache->nargs, proc->argtypes, &proc->rettype);
+		else
+			result = CallFunction(fcinfo, proc->xenv,
+						cache->nargs, proc->argtypes, &proc->rettype);
+		profile.done();
+		stats.done();
+		return result;
+	}
+	catch (js_error& e)	{ e.rethrow(); }
+	catch (pg_error& e)	{ e.rethrow(); }
+
+	return (Datum) 0;	// keep compiler quiet
+}
+
+Datum
+plv8_call_handler(PG_FUNCTION_ARGS)
+{
+	return common_pl_call_handler(fcinfo, PLV8_DIALECT_NONE);
+}
+
+Datum
+plcoffee_call_handler(PG_FUNCTION_ARGS)
+{
+	return common_pl_call_handler(fcinfo, PLV8_DIALECT_COFFEE);
+}
+
+Datum
+plls_call_handler(PG_FUNCTION_ARGS)
+{
+	return common_pl_call_handler(fcinfo, PLV8_DIALECT_LIVESCRIPT);
+}
+
+/*
+ * Detach the receiver of a proc cache entry.  Calls already set up keep
+ * using it until the end of the transaction, when it is freed.
+ */
+static void ReleaseExecEnv(plv8_proc_cache *cache)
+{
+	if (cache->xenv)
+	{
+		cache->xenv->next = exec_env_head;
+		exec_env_head = cache->xenv;
+		cache->xenv = NULL;
+	}
+}
+
+/*
+ * Drop the compiled function and source of a proc cache entry, the entry
+ * itself stays so that plv8_proc structs pointing to it remain valid.
+ */
+static void ReleaseProc(plv8_proc_cache *cache)
+{
+	if (!cache->function.IsEmpty())
+	{
+		dlist_delete(&cache->lru_node);
+		plv8_proc_lru_count--;
+		plv8_proc_lru_size -= cache->code_size;
+		cache->function.Reset();
+	}
+	ReleaseExecEnv(cache);
+	if (cache->prosrc)
+	{
+		pfree(cache->prosrc);
+		cache->prosrc = NULL;
+	}
+}
+
+/*
+ * to_regprocedure() or to_regproc() of a plv8.pinned_functions item, they
+ * return NULL instead of raising an error for unknown or overloaded names.
+ */
+static Oid LookupPinnedFunction(const char *name)
+{
+	PGFunction	lookup = strchr(name, '(') ? to_regprocedure : to_regproc;
+	Datum		result;
+#if PG_VERSION_NUM < 120000
+	FunctionCallInfoData	fcinfo_data;
+	FunctionCallInfo		fcinfo = &fcinfo_data;
+
+	InitFunctionCallInfoData(*fcinfo, NULL, 1, InvalidOid, NULL, NULL);
+	fcinfo->arg[0] = CStringGetTextDatum(name);
+	fcinfo->argnull[0] = false;
+#else
+	LOCAL_FCINFO(fcinfo, 1);
+
+	InitFunctionCallInfoData(*fcinfo, NULL, 1, InvalidOid, NULL, NULL);
+	fcinfo->args[0].value = CStringGetTextDatum(name);
+	fcinfo->args[0].isnull = false;
+#endif
+	result = lookup(fcinfo);
+	return fcinfo->isnull ? InvalidOid : DatumGetObjectId(result);
+}
+
+/*
+ * Whether fn_oid is listed in plv8.pinned_functions.  The list is resolved
+ * to oids once, and again when the setting, the search path or any function,
+ * schema or role changes.  Items are function signatures, which may contain
+ * commas themselves, or names of functions that are not overloaded.
+ */
+static bool ProcIsPinned(Oid fn_oid)
+{
+	static char			   *parsed = nullptr;
+	static const char	   *search_path = nullptr;
+	static uint32			generation = 0;
+	static std::vector<Oid>	oids;
+
+	if (plv8_pinned_functions == nullptr || plv8_pinned_functions[0] == '\0')
+		return false;
+
+	if (parsed == nullptr || strcmp(parsed, plv8_pinned_functions) != 0 ||
+		search_path != namespace_search_path ||
+		generation != plv8_find_function_generation)
+	{
+		char	   *rawnames = pstrdup(plv8_pinned_functions);
+		char	   *item = rawnames;
+		int			depth = 0;
+
+		oids.clear();
+		if (parsed != nullptr)
+			pfree(parsed);
+		parsed = MemoryContextStrdup(TopMemoryContext, plv8_pinned_functions);
+		search_path = namespace_search_path;
+		generation = plv8_find_function_generation;
+
+		for (char *cp = rawnames; ; cp++)
+		{
+			if (*cp == '(')
+				depth++;
+			else if (*cp == ')')
+				depth--;
+			else if ((*cp == ',' && depth == 0) || *cp == '\0')
+			{
+				bool	last = (*cp == '\0');
+				Oid		oid;
+
+				*cp = '\0';
+				while (scanner_isspace(*item))
+					item++;
+				if (*item != '\0' && OidIsValid(oid = LookupPinnedFunction(item)))
+					oids.push_back(oid);
+				if (last)
+					break;
+				item = cp + 1;
+			}
+		}
+		if (depth != 0)
+			elog(WARNING, "invalid list syntax in plv8.pinned_functions");
+		pfree(rawnames);
+	}
+
+	return std::find(oids.begin(), oids.end(), fn_oid) != oids.end();
+}
+
+/*
+ * Add a freshly compiled function to the LRU list, then release the least
+ * recently used unpinned functions until the cache is within its limits.
+ */
+static void CacheProc(plv8_proc_cache *cache)
+{
+	dlist_node	   *cur;
+
+	cache->code_size = strlen(cache->prosrc);
+	cache->pinned = ProcIsPinned(cache->key.fn_oid);
+	dlist_push_head(&plv8_proc_lru, &cache->lru_node);
+	plv8_proc_lru_count++;
+	plv8_proc_lru_size += cache->code_size;
+
+	cur = dlist_tail_node(&plv8_proc_lru);
+	while (cur != &plv8_proc_lru.head)
+	{
+		plv8_proc_cache *victim = dlist_container(plv8_proc_cache, lru_node, cur);
+
+		if ((plv8_function_cache_size <= 0 || plv8_proc_lru_count <= (size_t) plv8_function_cache_size) &&
+			(plv8_function_cache_budget <= 0 || plv8_proc_lru_size <= (size_t) plv8_function_cache_budget * 1_MB))
+			break;
+		cur = cur->prev;
+		if (victim == cache || victim->pinned)
+			continue;
+		ReleaseProc(victim);
+		plv8_procs_evicted++;
+	}
+}
+
+static void IndexProc(plv8_proc_cache *cache)
+{
+	plv8_proc_hashvalue	   *entry;
+	bool					found;
+
+	entry = (plv8_proc_hashvalue *)
+		hash_search(plv8_proc_hashvalue_hash, &cache->fn_hashvalue, HASH_ENTER, &found);
+	if (!found)
+		dlist_init(&entry->procs);
+	dlist_push_tail(&entry->procs, &cache->hash_node);
+}
+
+static void UnindexProc(plv8_proc_cache *cache)
+{
+	plv8_proc_hashvalue	   *entry;
+
+	dlist_delete(&cache->hash_node);
+	entry = (plv8_proc_hashvalue *)
+		hash_search(plv8_proc_hashvalue_hash, &cache->fn_hashvalue, HASH_FIND, nullptr);
+	if (entry != nullptr && dlist_is_empty(&entry->procs))
+		hash_search(plv8_proc_hashvalue_hash, &cache->fn_hashvalue, HASH_REMOVE, nullptr);
+}
+
+static void ClearProcContext(plv8_proc_context *ctx)
+{
+	dlist_mutable_iter	iter;
+
+	dlist_foreach_modify(iter, &ctx->procs)
+	{
+		plv8_proc_cache *cache = dlist_container(plv8_proc_cache, ctx_node, iter.cur);
+
+		dlist_delete(iter.cur);
+		ReleaseProc(cache);
+		UnindexProc(cache);
+		if (hash_search(plv8_proc_cache_hash,
+						(void *) &cache->key,
+						HASH_REMOVE,
+						nullptr) == nullptr)
+			elog(ERROR, "proc hash table corrupted");
+	}
+	if (hash_search(plv8_proc_context_hash,
+					(void *) &ctx->key,
+					HASH_REMOVE,
+					nullptr) == nullptr)
+		elog(ERROR, "proc context hash table corrupted");
+	/*
+	 * The plv8_proc structs of the flinfos of this transaction may point to
+	 * the entries just removed, make them look the function up again.
+	 */
+	plv8_runtime_generation++;
+}
+
+static void ClearProcCache(plv8_runtime *runtime, const char *context_id)
+{
+	HASH_SEQ_STATUS			status;
+	plv8_proc_context	   *ctx;
+
+	if (context_id != nullptr)
+	{
+		plv8_proc_context_key	key = {};
+
+		key.user_id = runtime->user_id;
+		strlcpy(key.user_ctx, context_id, NAMEDATALEN);
+		ctx = (plv8_proc_context *) hash_search(plv8_proc_context_hash,
+												(void *) &key, HASH_FIND, nullptr);
+		if (ctx != nullptr)
+			ClearProcContext(ctx);
+		return;
+	}
+
+	// only as many entries as the user has contexts, not functions
+	hash_seq_init(&status, plv8_proc_context_hash);
+	while ((ctx = (plv8_proc_context *) hash_seq_search(&status)) != nullptr)
+	{
+		if (ctx->key.user_id == runtime->user_id)
+			ClearProcContext(ctx);
+	}
+}
+
+/*
+ * Syscache callback for pg_proc.  The functions that changed are released
+ * right away, except the ones compiled from a pg_proc row this backend wrote
+ * itself: a backend also receives the invalidations of its own CREATE
+ * FUNCTION once it commits, and the functions compiled by the validator or
+ * called in that transaction are still up to date.  Those are marked
+ * invalid and checked against their pg_proc row by RevalidateProcs() on the
+ * next lookup.  A hash value of 0 means the whole syscache was reset, every
+ * entry is then checked when it is called.
+ */
+static void
+plv8_proc_invalidate(Datum arg, int cacheid, uint32 hashvalue)
+{
+	plv8_proc_hashvalue	   *entry;
+	dlist_iter				iter;
+	bool					queued = false;
+
+	if (hashvalue == 0)
+	{
+		HASH_SEQ_STATUS		status;
+		plv8_proc_cache	   *cache;
+
+		hash_seq_init(&status, plv8_proc_cache_hash);
+		while ((cache = (plv8_proc_cache *) hash_seq_search(&status)) != nullptr)
+			cache->valid = false;
+		return;
+	}
+
+	entry = (plv8_proc_hashvalue *)
+		hash_search(plv8_proc_hashvalue_hash, &hashvalue, HASH_FIND, nullptr);
+	if (entry != nullptr)
+	{
+		dlist_foreach(iter, &entry->procs)
+		{
+			plv8_proc_cache *cache = dlist_container(plv8_proc_cache, hash_node, iter.cur);
+
+			cache->valid = false;
+			if (cache->fn_own && !cache->function.IsEmpty())
+				queued = true;
+			else
+				ReleaseProc(cache);
+		}
+	}
+	if (!queued)
+		DropCompiled(hashvalue);
+	else if (std::find(plv8_proc_changed.begin(), plv8_proc_changed.end(),
+					   hashvalue) == plv8_proc_changed.end())
+		plv8_proc_changed.push_back(hashvalue);
+}
+
+/*
+ * Check the functions left for later by plv8_proc_invalidate() against
+ * their pg_proc row, release the ones that changed and keep the others.
+ */
+static void
+RevalidateProcs(void)
+{
+	std::vector<uint32>	changed;
+
+	// the lookups below may invalidate more entries
+	changed.swap(plv8_proc_changed);
+	for (uint32 hashvalue : changed)
+	{
+		plv8_proc_hashvalue	   *entry;
+		dlist_iter				iter;
+		bool					released = false;
+
+		entry = (plv8_proc_hashvalue *)
+			hash_search(plv8_proc_hashvalue_hash, &hashvalue, HASH_FIND, nullptr);
+		if (entry == nullptr)
+			continue;
+		dlist_foreach(iter, &entry->procs)
+		{
+			plv8_proc_cache *cache = dlist_container(plv8_proc_cache, hash_node, iter.cur);
+			HeapTuple	procTup;
+
+			if (cache->valid || cache->function.IsEmpty())
+				continue;
+
+			procTup = SearchSysCache(PROCOID, ObjectIdGetDatum(cache->key.fn_oid), 0, 0, 0);
+			if (HeapTupleIsValid(procTup) &&
+				cache->fn_xmin == HeapTupleHeaderGetXmin(procTup->t_data) &&
+				ItemPointerEquals(&cache->fn_tid, &procTup->t_self))
+			{
+				// the echo of our own change has arrived, later ones are not
+				cache->valid = true;
+				cache->fn_own = false;
+			}
+			else
+			{
+				ReleaseProc(cache);
+				released = true;
+			}
+			if (HeapTupleIsValid(procTup))
+				ReleaseSysCache(procTup);
+		}
+		if (released)
+			DropCompiled(hashvalue);
+	}
+}
+
+/*
+ * Syscache callback for everything plv8.find_function() results depend on:
+ * functions and their ACLs, languages, schemas, roles and role memberships.
+ */
+static void
+plv8_find_function_invalidate(Datum arg, int cacheid, uint32 hashvalue)
+{
+	plv8_find_function_generation++;
+	if (cacheid == LANGOID)
+		plv8_lang_oids_valid = false;
+}
+
+/*
+ * Relcache callback, the plv8_es_modules_changed trigger invalidates the
+ * relcache entry of plv8_es_modules on every change of the table.
+ */
+static void
+plv8_es_modules_invalidate(Datum arg, Oid relid)
+{
+	if (relid == InvalidOid || relid == plv8_es_modules_relid)
+	{
+		plv8_es_modules_generation++;
+		plv8_es_modules_relid = InvalidOid;
+	}
+}
+
+/*
+ * plv8_es_modules_changed() -- statement trigger of plv8_es_modules, makes
+ * every backend compile the modules again once the change is committed.
+ */
+Datum
+plv8_es_modules_changed(PG_FUNCTION_ARGS)
+{
+	TriggerData	   *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "plv8_es_modules_changed: not called by trigger manager");
+
+	CacheInvalidateRelcache(trigdata->tg_relation);
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * The source of a module in plv8_es_modules, NULL if there is no such module.
+ * The table is looked up in the schema of the plv8 extension, with the
+ * privileges of the current user.  JS code only runs in DoCall(), which is
+ * connected to SPI already.
+ */
+static char *
+plv8_module_source(const char *name)
+{
+	char	   *source = NULL;
+	Oid			argtypes[1] = { TEXTOID };
+	Datum		values[1];
+	bool		isnull;
+
+	if (!OidIsValid(plv8_es_modules_relid))
+	{
+		if (SPI_execute("SELECT c.oid FROM pg_catalog.pg_class c"
+						" JOIN pg_catalog.pg_extension e ON e.extnamespace = c.relnamespace"
+						" WHERE e.extname = 'plv8' AND c.relname = 'plv8_es_modules'",
+						true, 1) != SPI_OK_SELECT || SPI_processed != 1)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_TABLE),
+					 errmsg("plv8_es_modules table does not exist")));
+		plv8_es_modules_relid = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0],
+															   SPI_tuptable->tupdesc, 1, &isnull));
+	}
+
+	StringInfoData	query;
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT source FROM %s WHERE name = $1",
+					 quote_qualified_identifier(get_namespace_name(get_rel_namespace(plv8_es_modules_relid)),
+												get_rel_name(plv8_es_modules_relid)));
+	values[0] = CStringGetTextDatum(name);
+	if (SPI_execute_with_args(query.data, 1, argtypes, values, NULL, true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "could not read plv8_es_modules");
+	if (SPI_processed == 1)
+	{
+		Datum	value = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+
+		if (!isnull)
+			source = TextDatumGetCString(value);
+	}
+
+	return source;
+}
+
+static void KillRuntime(plv8_runtime *runtime)
+{
+	runtime->clearEvalCache();
+	if (runtime->profiler)
+		runtime->profiler->Dispose();
+	runtime->isolate->Dispose();
+	delete runtime->array_buffer_allocator;
+	/* off-heap HashMaps die with their isolate */
+	if (runtime->hashmap_context)
+		MemoryContextDelete(runtime->hashmap_context);
+}
+
+/*
+ * The user whose runtime runs code for user_id.  Roles listed in
+ * plv8.shared_isolate_roles all use the runtime of the first existing one,
+ * so that calls between them never switch isolates.
+ */
+static Oid RuntimeOwner(Oid user_id)
+{
+	static char			   *parsed = nullptr;
+	static std::vector<Oid>	roles;
+
+	if (plv8_shared_isolate_roles == nullptr || plv8_shared_isolate_roles[0] == '\0')
+		return user_id;
+
+	if (parsed == nullptr || strcmp(parsed, plv8_shared_isolate_roles) != 0)
+	{
+		char	   *rawnames;
+		List	   *names;
+		ListCell   *lc;
+
+		roles.clear();
+		if (parsed != nullptr)
+			pfree(parsed);
+		parsed = MemoryContextStrdup(TopMemoryContext, plv8_shared_isolate_roles);
+
+		rawnames = pstrdup(plv8_shared_isolate_roles);
+		if (!SplitIdentifierString(rawnames, ',', &names))
+			elog(WARNING, "invalid list syntax in plv8.shared_isolate_roles");
+		else
+		{
+			foreach(lc, names)
+			{
+				Oid		role = get_role_oid((char *) lfirst(lc), true);
+
+				if (OidIsValid(role))
+					roles.push_back(role);
+			}
+			list_free(names);
+		}
+		pfree(rawnames);
+	}
+
+	for (auto role: roles)
+	{
+		if (role == user_id)
+			return roles[0];
+	}
+	return user_id;
+}
+
+/*
+ * Remove a runtime from the cache and dispose of its isolate.  The caller
+ * makes sure the isolate is not running any code.
+ */
+static void DisposeRuntime(plv8_runtime *runtime)
+{
+	auto	it = RuntimeIndex.find(runtime->user_id);
+
+	if (it != RuntimeIndex.end())
+	{
+		RuntimeCache.erase(it->second);
+		RuntimeIndex.erase(it);
+	}
+	if (current_runtime == runtime)
+		current_runtime = nullptr;
+	ClearProcCache(runtime);
+	// the handles can't be reset at the end of the transaction anymore
+	for (plv8_exec_env *env = exec_env_head; env; env = env->next)
+	{
+		if (env->isolate == runtime->isolate)
+			env->recv.Reset();
+	}
+	KillRuntime(runtime);
+	pfree(runtime);
+	plv8_runtime_generation++;
+}
+
+/*
+ * Make room for one more runtime under plv8.max_isolates, starting with
+ * the least recently used one.  Runtimes still running code further up the
+ * stack (SECURITY DEFINER chains) are skipped, in which case the limit is
+ * exceeded for a while.
+ */
+static void EvictRuntimes()
+{
+	if (plv8_max_isolates <= 0)
+		return;
+
+	auto	it = RuntimeCache.end();
+	while (RuntimeCache.size() >= (size_t) plv8_max_isolates && it != RuntimeCache.begin())
+	{
+		plv8_runtime   *runtime = *--it;
+
+		if (runtime == current_runtime || runtime->isolate->IsInUse())
+			continue;
+		elog(DEBUG1, "plv8: disposing of the isolate for %s, max_isolates reached",
+			 GetUserNameFromId(runtime->user_id, false));
+		it = RuntimeCache.erase(it);
+		RuntimeIndex.erase(runtime->user_id);
+		DisposeRuntime(runtime);
+		plv8_runtimes_evicted++;
+	}
+}
+
+Datum
+plv8_reset(PG_FUNCTION_ARGS)
+{
+	const char 			*ptr = PG_GETARG_POINTER(0);
+	const char			*context_id;
+	auto				it = RuntimeIndex.find(RuntimeOwner(GetUserId()));
+
+	if (ptr != nullptr)
+		context_id = text_to_cstring(DatumGetTextPP(ptr));
+	else
+		context_id = nullptr;
+	if (it != RuntimeIndex.end())
+	{
+		plv8_runtime *runtime = *it->second;
+		if (runtime->isolate->IsInUse()) // was launched from SPI, cannot kill "self"
+			elog(ERROR, "Cannot be run from inside the transaction context");
+		if (context_id != nullptr)
+			runtime->removeContext(context_id);
+		else
+			DisposeRuntime(runtime); // kill the runtime completely
+	}
+	return (Datum) 0;
+}
+
+/*
+ * plv8_reset_contexts() -- discard the JS state of the user but keep the
+ * isolate, cheap enough for the reset query of a connection pooler.  When
+ * called from JS, the contexts are reset at the end of the transaction.
+ */
+Datum
+plv8_reset_contexts(PG_FUNCTION_ARGS)
+{
+	auto	it = RuntimeIndex.find(RuntimeOwner(GetUserId()));
+
+	if (it != RuntimeIndex.end())
+	{
+		plv8_runtime *runtime = *it->second;
+
+		if (runtime->wasKilled())
+			DisposeRuntime(runtime);
+		else if (runtime->isolate->IsInUse())
+			runtime->reset_pending = true;
+		else
+			runtime->resetContexts();
+	}
+	return (Datum) 0;
+}
+
+/*
+ * plv8_runtime_cache() -- counters of the per backend isolate cache.
+ */
+Datum
+plv8_runtime_cache(PG_FUNCTION_ARGS)
+{
+	StringInfoData	buf;
+
+	initStringInfo(&buf);
+	appendStringInfo(&buf,
+					 "{\"runtimes\":%d,\"max_isolates\":%d,\"created\":" UINT64_FORMAT
+					 ",\"evicted\":" UINT64_FORMAT ",\"hits\":" UINT64_FORMAT
+					 ",\"misses\":" UINT64_FORMAT "}",
+					 (int) RuntimeCache.size(), plv8_max_isolates, plv8_runtimes_created,
+					 plv8_runtimes_evicted, plv8_runtime_hits, plv8_runtime_misses);
+	PG_RETURN_TEXT_P(cstring_to_text_with_len(buf.data, buf.len));
+}
+
+/*
+ * plv8_function_cache() -- counters of the compiled function cache.
+ */
+Datum
+plv8_function_cache(PG_FUNCTION_ARGS)
+{
+	StringInfoData		buf;
+	dlist_iter			iter;
+	int					pinned = 0;
+
+	dlist_foreach(iter, &plv8_proc_lru)
+	{
+		if (dlist_container(plv8_proc_cache, lru_node, iter.cur)->pinned)
+			pinned++;
+	}
+
+	initStringInfo(&buf);
+	appendStringInfo(&buf,
+					 "{\"functions\":%d,\"pinned\":%d,\"code_size\":" UINT64_FORMAT
+					 ",\"evicted\":" UINT64_FORMAT ",\"hits\":" UINT64_FORMAT
+					 ",\"misses\":" UINT64_FORMAT ",\"compiled\":%d,\"compiled_size\":" UINT64_FORMAT
+					 ",\"compiled_hits\":" UINT64_FORMAT ",\"compiler_cache_hits\":" UINT64_FORMAT
+					 ",\"compiler_cache_rejected\":" UINT64_FORMAT "}",
+					 (int) plv8_proc_lru_count, pinned, (uint64) plv8_proc_lru_size,
+					 plv8_procs_evicted, plv8_proc_hits, plv8_proc_misses,
+					 (int) CompileLRU.size(), (uint64) compile_cache_size, compile_cache_hits,
+					 compiler_cache_hits, compiler_cache_rejected);
+	PG_RETURN_TEXT_P(cstring_to_text_with_len(buf.data, buf.len));
+}
+
+static void
+GetAllocatorInfo(Local<v8::Object> obj, ArrayAllocator *allocator)
+{
+	Isolate 		   *isolate = obj->GetIsolate();
+	Local<Context>		context = isolate->GetCurrentContext();
+	Local<v8::Object>	stats = v8::Object::New(isolate);
+
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "allocated"),
+			   Number::New(isolate, allocator->GetAllocated())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "peak"),
+			   Number::New(isolate, allocator->GetPeak())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "soft_limit"),
+			   Number::New(isolate, allocator->GetSoftLimit())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "hard_limit"),
+			   Number::New(isolate, allocator->GetHardLimit())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "allocations"),
+			   Number::New(isolate, allocator->GetAllocations())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "failed_allocations"),
+			   Number::New(isolate, allocator->GetFailedAllocations())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "soft_limit_hits"),
+			   Number::New(isolate, allocator->GetSoftLimitHits())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "pooled"),
+			   Number::New(isolate, allocator->GetPooledBytes())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "reserved"),
+			   Number::New(isolate, allocator->GetReservedBytes())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "mapped"),
+			   Number::New(isolate, allocator->GetMappedBytes())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "pool_hits"),
+			   Number::New(isolate, allocator->GetPoolHits())).Check();
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "pool_misses"),
+			   Number::New(isolate, allocator->GetPoolMisses())).Check();
+	// share of the pooled chunks lost to size class rounding
+	size_t reserved = allocator->GetReservedBytes();
+	double fragmentation = reserved == 0 ? 0 :
+		1.0 - (double) allocator->GetRequestedBytes() / reserved;
+	stats->Set(context, String::NewFromUtf8Literal(isolate, "fragmentation"),
+			   Number::New(isolate, fragmentation)).Check();
+	obj->Set(context, String::NewFromUtf8Literal(isolate, "array_buffers"), stats).Check();
+}
+
+Datum
+plv8_info(PG_FUNCTION_ARGS)
+{
+	unsigned long		i;
+	unsigned long 		size = RuntimeCache.size();
+	char 				*infos[size];
+	size_t 				lengths[size];
+	size_t 				total_length = 3; // length of "[]\0"
+
+	i = 0;
+	for (auto runtime: RuntimeCache)
+	{
+		Isolate 	   	   *isolate = runtime->isolate;
+		Isolate::Scope		scope(isolate);
+		HandleScope			handle_scope(isolate);
+		Local<Context>		context = runtime->compile_context.Get(isolate);
+		Context::Scope		context_scope(context);
+		JSONObject 			JSON;
+		Local<v8::Value>	result;
+		Local<v8::Object>	infoObj = v8::Object::New(isolate);
+		Local<v8::Array>  	contextList = v8::Array::New(isolate);
+
+#if PG_VERSION_NUM >= 90500
+		char 			   *username = GetUserNameFromId(runtime->user_id, false);
+#else
+		char 			   *username = GetUserNameFromId(runtime->user_id);
+#endif
+		infoObj->Set(context, String::NewFromUtf8Literal(isolate, "user"),
+					 String::NewFromUtf8(isolate, username).ToLocalChecked()).Check();
+		GetMemoryInfo(infoObj);
+		GetAllocatorInfo(infoObj, static_cast<ArrayAllocator *>(runtime->array_buffer_allocator));
+		infoObj->Set(context, String::NewFromUtf8Literal(isolate, "heap_limit_recovered"),
+					 Number::New(isolate, runtime->heap_limit_recovered)).Check();
+		infoObj->Set(context, String::NewFromUtf8Literal(isolate, "heap_limit_killed"),
+					 Number::New(isolate, runtime->heap_limit_killed)).Check();
+		Local<v8::Object>	contextSizes = v8::Object::New(isolate);
+		size_t idx = 0;
+		for (auto &it: runtime->ctx_queue) {
+			Local<v8::String> key = String::NewFromUtf8(isolate, std::get<0>(it).c_str()).ToLocalChecked();
+			contextList->Set(context, idx++, key).Check();
+			contextSizes->Set(context, key, Number::New(isolate, std::get<2>(it))).Check();
+		}
+		infoObj->Set(context, String::NewFromUtf8Literal(isolate, "contexts"), contextList).Check();
+		infoObj->Set(context, String::NewFromUtf8Literal(isolate, "context_sizes"), contextSizes).Check();
+		Local<v8::Object>	evalCache = v8::Object::New(isolate);
+		evalCache->Set(context, String::NewFromUtf8Literal(isolate, "functions"),
+					   Number::New(isolate, runtime->eval_map.size())).Check();
+		evalCache->Set(context, String::NewFromUtf8Literal(isolate, "code_size"),
+					   Number::New(isolate, runtime->eval_size)).Check();
+		evalCache->Set(context, String::NewFromUtf8Literal(isolate, "evicted"),
+					   Number::New(isolate, runtime->eval_evicted)).Check();
+		evalCache->Set(context, String::NewFromUtf8Literal(isolate, "hits"),
+					   Number::New(isolate, runtime->eval_hits)).Check();
+		evalCache->Set(context, String::NewFromUtf8Literal(isolate, "misses"),
+					   Number::New(isolate, runtime->eval_misses)).Check();
+		infoObj->Set(context, String::NewFromUtf8Literal(isolate, "eval_cache"), evalCache).Check();
+
+		result = JSON.Stringify(infoObj);
+		CString str(result);
+
+		infos[i] = pstrdup(str.str());
+		lengths[i] = strlen(infos[i]);
+		total_length += lengths[i] + 1; // add 1 byte for ','
+		i++;
+	}
+	char *out = (char *) palloc0(total_length);
+	out[0] = '[';
+	size_t current = 0;
+	for (i = 0; i < size; i++)
+	{
+		++current;
+		strcpy(out + current, infos[i]);
+		pfree(infos[i]);
+		current += lengths[i];
+		out[current] = ',';
+	}
+	// replace ",\0" with "]\0" at the end
+	out[(current > 0) ? current : total_length - 2] = ']';
+	return CStringGetTextDatum(out);
+}
+
+/*
+ * plv8_context_stats() -- accounting of every user context in this backend.
+ */
+Datum
+plv8_context_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	MemoryContext		oldcontext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+	MemoryContextSwitchTo(oldcontext);
+
+	for (auto runtime: RuntimeCache)
+	{
+		char		   *username = GetUserNameFromId(runtime->user_id, false);
+
+		for (auto &it: runtime->ctx_stats)
+		{
+			Datum		values[9];
+			bool		nulls[9] = {};
+			auto		ctx = runtime->ctx_map.find(it.first);
+
+			values[0] = CStringGetTextDatum(username);
+			values[1] = CStringGetTextDatum(it.first.c_str());
+			values[2] = Int64GetDatum((int64) it.second.calls);
+			values[3] = Float8GetDatum(it.second.cpu_time);
+			values[4] = Int64GetDatum(it.second.heap_delta);
+			if (ctx != runtime->ctx_map.end())
+				values[5] = Int64GetDatum((int64) std::get<2>(*ctx->second));
+			else
+				nulls[5] = true;
+			values[6] = Int64GetDatum((int64) it.second.throttled);
+			values[7] = Int64GetDatum((int64) it.second.failed);
+			values[8] = Int64GetDatum((int64) it.second.evicted);
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * plv8_runtime_stats() -- heap, code and GC statistics of every isolate in
+ * this backend, followed by the last measured size of each of its user
+ * contexts.  Unlike plv8.memory_usage(), nothing here triggers a GC.
+ */
+Datum
+plv8_runtime_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	MemoryContext		oldcontext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+	MemoryContextSwitchTo(oldcontext);
+
+	for (auto runtime: RuntimeCache)
+	{
+		Isolate			   *isolate = runtime->isolate;
+		Isolate::Scope		scope(isolate);
+		char			   *username = GetUserNameFromId(runtime->user_id, false);
+		ArrayAllocator	   *allocator = static_cast<ArrayAllocator *>(runtime->array_buffer_allocator);
+		plv8_gc_stats	   *gc = &runtime->gc_stats;
+		HeapStatistics		heap;
+		HeapCodeStatistics	code;
+		StringInfoData		spaces;
+		Datum				pauses[PLV8_GC_PAUSE_BUCKETS];
+		Datum				values[22];
+		bool				nulls[22] = {};
+
+		isolate->GetHeapStatistics(&heap);
+		isolate->GetHeapCodeAndMetadataStatistics(&code);
+
+		initStringInfo(&spaces);
+		appendStringInfoChar(&spaces, '{');
+		for (size_t i = 0; i < isolate->NumberOfHeapSpaces(); i++)
+		{
+			HeapSpaceStatistics	space;
+
+			if (!isolate->GetHeapSpaceStatistics(&space, i))
+				continue;
+			appendStringInfo(&spaces,
+							 "%s\"%s\": {\"size\": %zu, \"used\": %zu, \"available\": %zu, \"physical\": %zu}",
+							 spaces.len > 1 ? ", " : "", space.space_name(),
+							 space.space_size(), space.space_used_size(),
+							 space.space_available_size(), space.physical_space_size());
+		}
+		appendStringInfoChar(&spaces, '}');
+
+		for (int i = 0; i < PLV8_GC_PAUSE_BUCKETS; i++)
+			pauses[i] = Int64GetDatum((int64) gc->pauses[i]);
+
+		values[0] = CStringGetTextDatum(username);
+		nulls[1] = true;
+		values[2] = Int64GetDatum((int64) heap.total_heap_size());
+		values[3] = Int64GetDatum((int64) heap.used_heap_size());
+		values[4] = Int64GetDatum((int64) heap.heap_size_limit());
+		values[5] = Int64GetDatum((int64) heap.total_physical_size());
+		values[6] = Int64GetDatum((int64) heap.external_memory());
+		values[7] = Int64GetDatum((int64) heap.malloced_memory());
+		values[8] = Int64GetDatum((int64) heap.number_of_native_contexts());
+		values[9] = Int64GetDatum((int64) heap.number_of_detached_contexts());
+		values[10] = CStringGetTextDatum(spaces.data);
+		values[11] = Int64GetDatum((int64) code.code_and_metadata_size());
+		values[12] = Int64GetDatum((int64) code.bytecode_and_metadata_size());
+		values[13] = Int64GetDatum((int64) code.external_script_source_size());
+		values[14] = Int64GetDatum((int64) gc->scavenges);
+		values[15] = Int64GetDatum((int64) gc->mark_compacts);
+		values[16] = Int64GetDatum((int64) gc->incremental_steps);
+		values[17] = Float8GetDatum(gc->total_time);
+		values[18] = Float8GetDatum(gc->max_pause);
+		values[19] = PointerGetDatum(construct_array(pauses, PLV8_GC_PAUSE_BUCKETS, INT8OID,
+													 sizeof(int64), FLOAT8PASSBYVAL, 'd'));
+		values[20] = Int64GetDatum((int64) allocator->GetAllocated());
+		values[21] = Int64GetDatum((int64) allocator->GetPeak());
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		pfree(spaces.data);
+
+		for (auto &it: runtime->ctx_queue)
+		{
+			Datum		ctx_values[22];
+			bool		ctx_nulls[22];
+
+			memset(ctx_nulls, true, sizeof(ctx_nulls));
+			ctx_values[0] = values[0];
+			ctx_nulls[0] = false;
+			ctx_values[1] = CStringGetTextDatum(std::get<0>(it).c_str());
+			ctx_nulls[1] = false;
+			ctx_values[2] = Int64GetDatum((int64) std::get<2>(it));
+			ctx_nulls[2] = false;
+			tuplestore_putvalues(tupstore, tupdesc, ctx_values, ctx_nulls);
+		}
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * plv8_profile_start(interval) -- start a CPU profile of the user's
+ * runtime, sampling every interval microseconds.
+ */
+Datum
+plv8_profile_start(PG_FUNCTION_ARGS)
+{
+	int32		interval = PG_GETARG_INT32(0);
+
+	if (interval < 50 || interval > 1000000)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("sampling interval must be between 50 and 1000000 microseconds")));
+
+	try
+	{
+		current_runtime = GetPlv8Runtime();
+		Isolate			   *isolate = current_runtime->isolate;
+		Isolate::Scope		scope(isolate);
+		HandleScope			handle_scope(isolate);
+
+		// one profile at a time, the calls of a profiled runtime are in it
+		if (current_runtime->profiling || current_runtime->call_profiling)
+			throw js_error("a profile is already in progress");
+		StartProfiling(current_runtime, "plv8_profile", interval);
+		current_runtime->profiling = true;
+	}
+	catch (js_error& e)	{ e.rethrow(); }
+	catch (pg_error& e)	{ e.rethrow(); }
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Profile file names are plain names in plv8_profiles.
+ */
+static void
+check_profile_filename(const char *filename)
+{
+	if (filename[0] == '\0' || filename[0] == '.' || first_dir_separator(filename) != NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid profile file name \"%s\"", filename),
+				 errhint("Profiles are saved in the %s directory.", PLV8_PROFILE_DIR)));
+}
+
+/*
+ * plv8_profile_stop(filename) -- stop the profile started by
+ * plv8_profile_start() and return it as .cpuprofile JSON, or save it as
+ * filename in plv8_profiles and return its path.
+ */
+Datum
+plv8_profile_stop(PG_FUNCTION_ARGS)
+{
+	char	   *filename = PG_ARGISNULL(0) ? NULL : text_to_cstring(PG_GETARG_TEXT_PP(0));
+	char	   *result = nullptr;
+
+	if (filename != NULL)
+		check_profile_filename(filename);
+
+	try
+	{
+		current_runtime = GetPlv8Runtime();
+		Isolate			   *isolate = current_runtime->isolate;
+		Isolate::Scope		scope(isolate);
+		HandleScope			handle_scope(isolate);
+
+		if (!current_runtime->profiling)
+			throw js_error("no profile is in progress");
+		current_runtime->profiling = false;
+
+		CpuProfile		   *profile = StopProfiling(current_runtime, "plv8_profile");
+
+		if (profile == nullptr)
+			throw js_error("no profile is in progress");
+		PG_TRY();
+		{
+			result = plv8_profile_json(current_runtime, profile);
+			if (filename != NULL)
+				result = plv8_profile_save(filename, result, ERROR);
+		}
+		PG_CATCH();
+		{
+			profile->Delete();
+			throw pg_error();
+		}
+		PG_END_TRY();
+		profile->Delete();
+	}
+	catch (js_error& e)	{ e.rethrow(); }
+	catch (pg_error& e)	{ e.rethrow(); }
+
+	PG_RETURN_TEXT_P(cstring_to_text(result));
+}
+
+/*
+ * plv8_profile_remove(filename) -- remove a profile saved in plv8_profiles,
+ * false if there is none of that name.
+ */
+Datum
+plv8_profile_remove(PG_FUNCTION_ARGS)
+{
+	char	   *filename = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	char	   *path;
+
+	check_profile_filename(filename);
+	path = psprintf("%s/%s", PLV8_PROFILE_DIR, filename);
+	if (unlink(path) < 0)
+	{
+		if (errno != ENOENT)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not remove file \"%s\": %m", path)));
+		PG_RETURN_BOOL(false);
+	}
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * plv8_eval(src text, args) -- run src as the body of a function taking
+ * args, which is either jsonb or an array, and return the result as jsonb.
+ * The compiled function is kept in the runtime's plv8.compile() cache, so
+ * evaluating the same source again only pays for the call.
+ */
+Datum
+plv8_eval(PG_FUNCTION_ARGS)
+{
+	text			   *src;
+	char			   *result_text = nullptr;
+	bool				result_null = true;
+	Oid					lang_oid;
+	bool				allowed;
+
+	// arbitrary code, which needs USAGE on the language like a DO block
+	lang_oid = get_language_oid("plv8", false);
+#if PG_VERSION_NUM >= 160000
+	allowed = object_aclcheck(LanguageRelationId, lang_oid, GetUserId(), ACL_USAGE) == ACLCHECK_OK;
+#else
+	allowed = pg_language_aclcheck(lang_oid, GetUserId(), ACL_USAGE) == ACLCHECK_OK;
+#endif
+	if (!allowed)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("permission denied for language plv8")));
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+	src = PG_GETARG_TEXT_PP(0);
 
 	try
 	{
-		current_runtime = GetPlv8Runtime();
 #ifdef ENABLE_DEBUGGER_SUPPORT
 		Locker				lock;
 #endif  // ENABLE_DEBUGGER_SUPPORT
-		Isolate::Scope	scope(current_runtime->isolate);
-		HandleScope	handle_scope(current_runtime->isolate);
+		current_runtime = GetPlv8Runtime();
+		Isolate			   *isolate = current_runtime->isolate;
+		Isolate::Scope		scope(isolate);
+		HandleScope			handle_scope(isolate);
+		Local<Context>		context = current_runtime->localContext();
+		Context::Scope		context_scope(context);
+		Handle<v8::Value>	args[1];
 
-		if (!fcinfo->flinfo->fn_extra)
+		Local<Function>	function = current_runtime->compileEval(VARDATA_ANY(src),
+																VARSIZE_ANY_EXHDR(src));
+		if (PG_NARGS() < 2 || PG_ARGISNULL(1))
+			args[0] = Null(isolate);
+		else
 		{
-			plv8_proc	   *proc = Compile(fn_oid, fcinfo,
-										   false, is_trigger, dialect);
-			proc->xenv = CreateExecEnv(proc->cache->function, current_runtime);
-			fcinfo->flinfo->fn_extra = proc;
+			plv8_type	argtype;
+
+			plv8_fill_type(&argtype, get_fn_expr_argtype(fcinfo->flinfo, 1));
+			args[0] = ToValue(PG_GETARG_DATUM(1), false, &argtype);
 		}
 
-		plv8_proc *proc = (plv8_proc *) fcinfo->flinfo->fn_extra;
-		plv8_proc_cache *cache = proc->cache;
+		Local<v8::Value>	result = DoCall(context, function, context->Global(),
+											1, args, false);
+		if (!result->IsUndefined())
+		{
+			JSONObject			JSON;
+			Local<v8::Value>	json = JSON.Stringify(result);
 
-		if (is_trigger)
-			return CallTrigger(fcinfo, proc->xenv);
-		else if (cache->retset)
-			return CallSRFunction(fcinfo, proc->xenv,
-						cache->nargs, proc->argtypes, &proc->rettype);
-		else
-			return CallFunction(fcinfo, proc->xenv,
-						cache->nargs, proc->argtypes, &proc->rettype);
+			// functions and symbols have no JSON representation either
+			if (!json->IsUndefined())
+			{
+				CString		str(json);
+
+				result_text = pstrdup(str);
+				result_null = false;
+			}
+		}
 	}
 	catch (js_error& e)	{ e.rethrow(); }
 	catch (pg_error& e)	{ e.rethrow(); }
 
-	return (Datum) 0;	// keep compiler quiet
+	if (result_null)
+		PG_RETURN_NULL();
+	return DirectFunctionCall1(jsonb_in, CStringGetDatum(result_text));
 }
 
+/*
+ * plv8_warmup(regprocedure[]) -- compile functions ahead of their first
+ * call, for the current user and context.  Returns how many of them are
+ * compiled, functions in other languages or that the user cannot execute
+ * are skipped.
+ */
 Datum
-plv8_call_handler(PG_FUNCTION_ARGS)
+plv8_warmup(PG_FUNCTION_ARGS)
 {
-	return common_pl_call_handler(fcinfo, PLV8_DIALECT_NONE);
-}
+	ArrayType	   *arr;
+	Datum		   *elems;
+	bool		   *nulls;
+	int				nelems;
+	int32			warmed = 0;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_INT32(0);
+	arr = PG_GETARG_ARRAYTYPE_P(0);
+	deconstruct_array(arr, REGPROCEDUREOID, sizeof(Oid), true, 'i',
+					  &elems, &nulls, &nelems);
 
-Datum
-plcoffee_call_handler(PG_FUNCTION_ARGS)
-{
-	return common_pl_call_handler(fcinfo, PLV8_DIALECT_COFFEE);
-}
+	try
+	{
+		for (int i = 0; i < nelems; i++)
+		{
+			if (!nulls[i] && WarmFunction(DatumGetObjectId(elems[i])))
+				warmed++;
+		}
+	}
+	catch (js_error& e)	{ e.rethrow(); }
+	catch (pg_error& e)	{ e.rethrow(); }
 
-Datum
-plls_call_handler(PG_FUNCTION_ARGS)
-{
-	return common_pl_call_handler(fcinfo, PLV8_DIALECT_LIVESCRIPT);
+	PG_RETURN_INT32(warmed);
 }
 
-static void ClearProcCache(plv8_runtime *runtime, const char *context_id)
+/*
+ * Compile a function eagerly if it is a PLV8 function the current user can
+ * execute.
+ */
+static bool
+WarmFunction(Oid fn_oid)
 {
-	HASH_SEQ_STATUS		status;
-	plv8_proc_cache*	cache;
+	HeapTuple	tuple;
+	int			langno = -1;
+	bool		is_trigger = false;
+	bool		allowed = false;
 
-	hash_seq_init(&status, plv8_proc_cache_hash);
-	cache = (plv8_proc_cache *) hash_seq_search(&status);
-	while (cache != nullptr)
+	PG_TRY();
 	{
-		if (cache->key.user_id == runtime->user_id)
+		tuple = SearchSysCache(PROCOID, ObjectIdGetDatum(fn_oid), 0, 0, 0);
+		if (HeapTupleIsValid(tuple))
 		{
-			if (context_id == nullptr)
-			{
-				cache->function.Reset();
-				if (hash_search(plv8_proc_cache_hash,
-								(void *) &cache->key,
-								HASH_REMOVE,
-								nullptr) == nullptr)
-					elog(ERROR, "proc hash table corrupted");
-			}
-			else if (strncmp(cache->key.user_ctx, context_id, NAMEDATALEN) == 0)
-			{
-				cache->function.Reset();
-				if (hash_search(plv8_proc_cache_hash,
-								(void *) &cache->key,
-								HASH_REMOVE,
-								nullptr) == nullptr)
-					elog(ERROR, "proc hash table corrupted");
-			}
+			is_trigger = ((Form_pg_proc) GETSTRUCT(tuple))->prorettype == TRIGGEROID;
+			ReleaseSysCache(tuple);
+			langno = FindJsLanguage(fn_oid);
+#if PG_VERSION_NUM >= 160000
+			allowed = object_aclcheck(ProcedureRelationId, fn_oid,
+									  GetUserId(), ACL_EXECUTE) == ACLCHECK_OK;
+#else
+			allowed = pg_proc_aclcheck(fn_oid, GetUserId(), ACL_EXECUTE) == ACLCHECK_OK;
+#endif
 		}
-		cache = (plv8_proc_cache *) hash_seq_search(&status);
 	}
-}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
 
-static void KillRuntime(plv8_runtime *runtime)
-{
-	runtime->isolate->Dispose();
-	delete runtime->array_buffer_allocator;
+	if (langno < 0 || !allowed)
+		return false;
+
+	(void) Compile(fn_oid, NULL, false, is_trigger,
+				   (Dialect) (PLV8_DIALECT_NONE + langno), true);
+	return true;
 }
 
-Datum
-plv8_reset(PG_FUNCTION_ARGS)
+/*
+ * Compile the functions saved by the last backends to exit, once per
+ * backend before its first call.  Each one is compiled in a subtransaction,
+ * functions failing to compile, in V8 or in postgres, are rolled back and
+ * left for their own call to report.
+ */
+static void
+Autowarm()
 {
-	Oid					user_id = GetUserId();
-	unsigned long		i;
-	const char 			*ptr = PG_GETARG_POINTER(0);
-	const char			*context_id;
+	std::vector<Oid>	oids;
+	MemoryContext		ctx = CurrentMemoryContext;
 
-	if (ptr != nullptr)
-		context_id = text_to_cstring(DatumGetTextPP(ptr));
-	else
-		context_id = nullptr;
-	for (i = 0; i < RuntimeCache.size(); i++)
+	autowarm_done = true;
+	if (plv8_autowarm_size <= 0)
+		return;
+
+	PG_TRY();
+	{
+		plv8_autowarm_load(oids);
+	}
+	PG_CATCH();
 	{
-		if (RuntimeCache[i]->user_id == user_id)
+		throw pg_error();
+	}
+	PG_END_TRY();
+
+	for (auto fn_oid: oids)
+	{
+		SubTranBlock	subtran;
+		bool			success = false;
+
+		PG_TRY();
 		{
-			plv8_runtime *runtime = RuntimeCache[i];
-			if (runtime->isolate->IsInUse()) // was launched from SPI, cannot kill "self"
-				elog(ERROR, "Cannot be run from inside the transaction context");
-			if (context_id != nullptr)
-				runtime->removeContext(context_id);
-			else
-			{
-				// kill the runtime completely
-				if (current_runtime == runtime)
-					current_runtime = nullptr;
-				ClearProcCache(runtime);
-				KillRuntime(runtime);
-				RuntimeCache.erase(RuntimeCache.begin() + i);
-				pfree(runtime);
-			}
-			break;
+			subtran.enter();
+		}
+		PG_CATCH();
+		{
+			throw pg_error();
+		}
+		PG_END_TRY();
+
+		try
+		{
+			(void) WarmFunction(fn_oid);
+			success = true;
+		}
+		catch (js_error& e) { }
+		catch (pg_error& e)
+		{
+			MemoryContextSwitchTo(ctx);
+			FlushErrorState();
+		}
+
+		PG_TRY();
+		{
+			subtran.exit(success);
+		}
+		PG_CATCH();
+		{
+			throw pg_error();
 		}
+		PG_END_TRY();
 	}
-	return (Datum) 0;
 }
 
-Datum
-plv8_info(PG_FUNCTION_ARGS)
+static void
+plv8_autowarm_path(char *path, const char *suffix)
 {
-	unsigned long		i;
-	unsigned long 		size = RuntimeCache.size();
-	char 				*infos[size];
-	size_t 				lengths[size];
-	size_t 				total_length = 3; // length of "[]\0"
+	snprintf(path, MAXPGPATH, "plv8_autowarm.%u%s", MyDatabaseId, suffix);
+}
 
-	for (i = 0; i < size; i++)
-	{
-		Isolate 	   	   *isolate = RuntimeCache[i]->isolate;
-		Isolate::Scope		scope(isolate);
-		HandleScope			handle_scope(isolate);
-		Local<Context>		context = RuntimeCache[i]->compile_context.Get(isolate);
-		Context::Scope		context_scope(context);
-		JSONObject 			JSON;
-		Local<v8::Value>	result;
-		Local<v8::Object>	infoObj = v8::Object::New(isolate);
-		Local<v8::Array>  	contextList = v8::Array::New(isolate);
+/*
+ * Read the function list saved by plv8_autowarm_save().  Missing or
+ * unreadable files are ignored.
+ */
+static void
+plv8_autowarm_load(std::vector<Oid> &oids)
+{
+	char		path[MAXPGPATH];
+	FILE	   *file;
+	Oid			fn_oid;
+
+	plv8_autowarm_path(path, "");
+	file = AllocateFile(path, PG_BINARY_R);
+	if (file == NULL)
+		return;
+	while (oids.size() < (size_t) plv8_autowarm_size &&
+		   fscanf(file, "%u\n", &fn_oid) == 1)
+		oids.push_back(fn_oid);
+	FreeFile(file);
+}
 
-#if PG_VERSION_NUM >= 90500
-		char 			   *username = GetUserNameFromId(RuntimeCache[i]->user_id, false);
-#else
-		char 			   *username = GetUserNameFromId(ContextVector[i]->user_id);
-#endif
-		infoObj->Set(context, String::NewFromUtf8Literal(isolate, "user"),
-					 String::NewFromUtf8(isolate, username).ToLocalChecked()).Check();
-		GetMemoryInfo(infoObj);
-		size_t idx = 0;
-		for (auto &it: RuntimeCache[i]->ctx_queue) {
-			Local<v8::String> key = String::NewFromUtf8(isolate, std::get<0>(it).c_str()).ToLocalChecked();
-			contextList->Set(context, idx++, key).Check();
-		}
-		infoObj->Set(context, String::NewFromUtf8Literal(isolate, "contexts"), contextList).Check();
+/*
+ * on_proc_exit callback saving the most recently used functions of the
+ * function cache, for the next backends of the database to compile ahead
+ * of their first call.  Backends which did not compile any function leave
+ * the list alone.
+ */
+static void
+plv8_autowarm_save(int code, Datum arg)
+{
+	char				path[MAXPGPATH];
+	char				tmppath[MAXPGPATH];
+	std::vector<Oid>	oids;
+	dlist_iter			iter;
+	FILE			   *file;
 
-		result = JSON.Stringify(infoObj);
-		CString str(result);
+	if (plv8_autowarm_size <= 0 || !OidIsValid(MyDatabaseId))
+		return;
 
-		infos[i] = pstrdup(str.str());
-		lengths[i] = strlen(infos[i]);
-		total_length += lengths[i] + 1; // add 1 byte for ','
+	dlist_foreach(iter, &plv8_proc_lru)
+	{
+		Oid		fn_oid = dlist_container(plv8_proc_cache, lru_node, iter.cur)->key.fn_oid;
+
+		if (oids.size() >= (size_t) plv8_autowarm_size)
+			break;
+		// the same function may be compiled for several users or contexts
+		if (std::find(oids.begin(), oids.end(), fn_oid) == oids.end())
+			oids.push_back(fn_oid);
 	}
-	char *out = (char *) palloc0(total_length);
-	out[0] = '[';
-	size_t current = 0;
-	for (i = 0; i < size; i++)
+	if (oids.empty())
+		return;
+
+	plv8_autowarm_path(path, "");
+	snprintf(tmppath, MAXPGPATH, "%s.%d", path, MyProcPid);
+	file = AllocateFile(tmppath, PG_BINARY_W);
+	if (file == NULL)
 	{
-		++current;
-		strcpy(out + current, infos[i]);
-		pfree(infos[i]);
-		current += lengths[i];
-		out[current] = ',';
+		elog(LOG, "could not create file \"%s\": %m", tmppath);
+		return;
+	}
+	for (auto fn_oid: oids)
+		fprintf(file, "%u\n", fn_oid);
+	if (FreeFile(file) != 0 || rename(tmppath, path) != 0)
+	{
+		elog(LOG, "could not save \"%s\": %m", path);
+		remove(tmppath);
+	}
+}
+
+/*
+ * The compiled functions of the runtime by the id of their script, for
+ * profiles to name them.
+ */
+void
+plv8_script_functions(plv8_runtime *runtime, plv8_script_map &functions)
+{
+	Isolate		   *isolate = runtime->isolate;
+	HandleScope		handle_scope(isolate);
+	dlist_iter		iter;
+
+	dlist_foreach(iter, &plv8_proc_lru)
+	{
+		plv8_proc_cache *cache = dlist_container(plv8_proc_cache, lru_node, iter.cur);
+
+		if (cache->key.user_id != runtime->user_id || cache->function.IsEmpty())
+			continue;
+		functions[cache->function.Get(isolate)->ScriptId()] =
+			std::make_pair(cache->key.fn_oid, (const char *) cache->proname);
 	}
-	// replace ",\0" with "]\0" at the end
-	out[(current > 0) ? current : total_length - 2] = ']';
-	return CStringGetTextDatum(out);
 }
 
 #if PG_VERSION_NUM >= 90000
@@ -803,10 +3006,17 @@ common_pl_inline_handler(PG_FUNCTION_ARGS, Dialect dialect) throw()
 		Isolate::Scope		scope(current_runtime->isolate);
 		HandleScope			handle_scope(current_runtime->isolate);
 		char			   *source_text = codeblock->source_text;
+		std::string			key = EvalKey('0' + dialect, source_text, strlen(source_text));
 
-		Local<Function>	function = CompileFunction(current_runtime,
-													  NULL, 0, NULL,
-													  source_text, false, false, dialect);
+		// the same blocks tend to be run over and over by maintenance scripts
+		Local<Function>	function = current_runtime->findEval(key);
+		if (function.IsEmpty())
+		{
+			function = CompileFunction(current_runtime,
+									   NULL, 0, NULL,
+									   source_text, false, false, dialect);
+			current_runtime->cacheEval(std::move(key), function);
+		}
 		plv8_exec_env	   *xenv = CreateExecEnv(function, current_runtime);
 		return CallFunction(fcinfo, xenv, 0, NULL, NULL);
 	}
@@ -880,6 +3090,168 @@ signal_handler (int sig) {
 	runtime->isolate->TerminateExecution();
 }
 
+/*
+ * ContextCall -- account a call to the current user context.
+ *
+ * Only the outermost call is accounted, nested calls are part of it, and
+ * only while plv8.track_contexts or a CPU quota is set.  The CPU quotas
+ * only apply to plv8.context contexts, not the default one.
+ * Statistics are kept for at most CONTEXT_STATS_MAX contexts, those of the
+ * least recently used contexts which are not live are dropped first.
+ */
+#define CONTEXT_STATS_MAX	1024
+
+static void
+PruneContextStats(plv8_runtime *runtime)
+{
+	std::vector<std::pair<TimestampTz, const std::string *>>	dead;
+
+	for (auto &it: runtime->ctx_stats)
+	{
+		if (!it.first.empty() && runtime->ctx_map.find(it.first) == runtime->ctx_map.end())
+			dead.emplace_back(it.second.last_used, &it.first);
+	}
+	std::sort(dead.begin(), dead.end());
+	for (auto &it: dead)
+	{
+		if (runtime->ctx_stats.size() <= CONTEXT_STATS_MAX)
+			break;
+		runtime->ctx_stats.erase(*it.second);
+	}
+}
+
+static double
+CpuTimeMs()
+{
+	struct rusage	r;
+
+	getrusage(RUSAGE_SELF, &r);
+	return (r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000.0 +
+		(r.ru_utime.tv_usec + r.ru_stime.tv_usec) / 1000.0;
+}
+
+/*
+ * Sleep until a point in time, in steps short enough to react to query
+ * cancellation and termination.
+ */
+static void
+ThrottleUntil(TimestampTz until)
+{
+	PG_TRY();
+	{
+		for (;;)
+		{
+			long	secs;
+			int		usecs;
+
+			CHECK_FOR_INTERRUPTS();
+			TimestampDifference(GetCurrentTimestamp(), until, &secs, &usecs);
+			if (secs == 0 && usecs == 0)
+				break;
+			pg_usleep(Min(secs * 1000000L + usecs, 10000L));
+		}
+	}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
+}
+
+class ContextCall
+{
+private:
+	Isolate			   *m_isolate;
+	plv8_context_stats *m_stats;
+	double				m_cpu_start;
+	size_t				m_heap_start;
+
+public:
+	explicit ContextCall(plv8_runtime *runtime) : m_isolate(runtime->isolate), m_stats(nullptr)
+	{
+		if (context_call_depth > 0)
+			return;
+
+		bool		user_context = plv8_user_context != nullptr && plv8_user_context[0] != '\0';
+
+		if (plv8_track_contexts == 0 &&
+			(!user_context || (plv8_context_cpu_soft_quota <= 0 && plv8_context_cpu_hard_quota <= 0)))
+			return;
+
+		const char *key = user_context ? plv8_user_context : "";
+		TimestampTz	now = GetCurrentTimestamp();
+
+		if (runtime->ctx_stats.size() >= CONTEXT_STATS_MAX &&
+			runtime->ctx_stats.find(key) == runtime->ctx_stats.end())
+			PruneContextStats(runtime);
+
+		plv8_context_stats *stats = &runtime->ctx_stats[key];
+
+		if (stats->window_start == 0 ||
+			TimestampDifferenceExceeds(stats->window_start, now, plv8_context_quota_interval * 1000))
+		{
+			stats->window_start = now;
+			stats->window_cpu_time = 0;
+		}
+
+		if (user_context)
+		{
+			if (plv8_context_cpu_hard_quota > 0 &&
+				stats->window_cpu_time > plv8_context_cpu_hard_quota)
+			{
+				char	msg[NAMEDATALEN + 64];
+
+				stats->failed++;
+				snprintf(msg, sizeof(msg), "context \"%s\" exceeded its CPU quota", plv8_user_context);
+				throw js_error(msg);
+			}
+			/*
+			 * Let the context use about half of the backend at most: a call
+			 * starting sooner after the previous one than twice the CPU time
+			 * of that call waits for the rest of it, one second at most.
+			 */
+			if (plv8_context_cpu_soft_quota > 0 &&
+				stats->window_cpu_time > plv8_context_cpu_soft_quota)
+			{
+				TimestampTz	until = TimestampTzPlusMilliseconds(stats->last_used,
+								(int64) Min(stats->last_cpu_time * 2, 1000.0));
+
+				if (now < until)
+				{
+					stats->throttled++;
+					ThrottleUntil(until);
+					now = GetCurrentTimestamp();
+				}
+			}
+		}
+
+		HeapStatistics	heap_statistics;
+		m_isolate->GetHeapStatistics(&heap_statistics);
+		m_heap_start = heap_statistics.used_heap_size();
+		m_cpu_start = CpuTimeMs();
+		m_stats = stats;
+		stats->last_used = now;
+		stats->calls++;
+		context_call_depth++;
+	}
+
+	~ContextCall()
+	{
+		if (m_stats == nullptr)
+			return;
+
+		HeapStatistics	heap_statistics;
+		double			cpu_time = CpuTimeMs() - m_cpu_start;
+
+		m_isolate->GetHeapStatistics(&heap_statistics);
+		m_stats->heap_delta += (int64) heap_statistics.used_heap_size() - (int64) m_heap_start;
+		m_stats->cpu_time += cpu_time;
+		m_stats->window_cpu_time += cpu_time;
+		m_stats->last_cpu_time = cpu_time;
+		context_call_depth--;
+	}
+};
+
 /*
  * DoCall -- Call a JS function with SPI support.
  *
@@ -894,6 +3266,8 @@ DoCall(Local<Context> ctx, Handle<Function> fn, Handle<Object> receiver,
 
 	CheckTermination(isolate);
 
+	ContextCall		context_call(current_runtime);
+
 #if PG_VERSION_NUM >= 110000
 	if (SPI_connect_ext(nonatomic ? SPI_OPT_NONATOMIC : 0) != SPI_OK_CONNECT)
 		throw js_error("could not connect to SPI manager");
@@ -990,21 +3364,26 @@ CallFunction(PG_FUNCTION_ARGS, plv8_exec_env *xenv,
 	 */
 	if (support.IsWindowCall())
 	{
+		StatsTimer		convert_stats(PLV8_STATS_CONVERT);
 		WindowObject winobj = support.GetWindowObject();
 		for (int i = 0; i < nargs; i++)
 		{
 			bool isnull;
 			Datum arg = WinGetFuncArgCurrent(winobj, i, &isnull);
 			args[i] = ToValue(arg, isnull, &argtypes[i]);
+			plv8_stats_datum(arg, isnull, &argtypes[i]);
 		}
 	}
 	else
 	{
+		StatsTimer		convert_stats(PLV8_STATS_CONVERT);
 		for (int i = 0; i < nargs; i++) {
 #if PG_VERSION_NUM < 120000
 			args[i] = ToValue(fcinfo->arg[i], fcinfo->argnull[i], &argtypes[i]);
+			plv8_stats_datum(fcinfo->arg[i], fcinfo->argnull[i], &argtypes[i]);
 #else
 			args[i] = ToValue(fcinfo->args[i].value, fcinfo->args[i].isnull, &argtypes[i]);
+			plv8_stats_datum(fcinfo->args[i].value, fcinfo->args[i].isnull, &argtypes[i]);
 #endif
 		}
 	}
@@ -1016,7 +3395,13 @@ CallFunction(PG_FUNCTION_ARGS, plv8_exec_env *xenv,
 		DoCall(context, fn, recv, nargs, args, nonatomic);
 
 	if (rettype)
-		return ToDatum(result, &fcinfo->isnull, rettype);
+	{
+		StatsTimer		convert_stats(PLV8_STATS_CONVERT);
+		Datum			datum = ToDatum(result, &fcinfo->isnull, rettype);
+
+		plv8_stats_datum(datum, fcinfo->isnull, rettype);
+		return datum;
+	}
 	else
 		PG_RETURN_VOID();
 }
@@ -1110,12 +3495,17 @@ CallSRFunction(PG_FUNCTION_ARGS, plv8_exec_env *xenv,
 	 */
 	SRFSupport support(context, &conv, tupstore);
 
-	for (int i = 0; i < nargs; i++) {
+	{
+		StatsTimer		convert_stats(PLV8_STATS_CONVERT);
+		for (int i = 0; i < nargs; i++) {
 #if PG_VERSION_NUM < 120000
-		args[i] = ToValue(fcinfo->arg[i], fcinfo->argnull[i], &argtypes[i]);
+			args[i] = ToValue(fcinfo->arg[i], fcinfo->argnull[i], &argtypes[i]);
+			plv8_stats_datum(fcinfo->arg[i], fcinfo->argnull[i], &argtypes[i]);
 #else
-		args[i] = ToValue(fcinfo->args[i].value, fcinfo->args[i].isnull, &argtypes[i]);
+			args[i] = ToValue(fcinfo->args[i].value, fcinfo->args[i].isnull, &argtypes[i]);
+			plv8_stats_datum(fcinfo->args[i].value, fcinfo->args[i].isnull, &argtypes[i]);
 #endif
+		}
 	}
 
 	Local<Object> recv = Local<Object>::New(xenv->isolate, xenv->recv);
@@ -1123,6 +3513,7 @@ CallSRFunction(PG_FUNCTION_ARGS, plv8_exec_env *xenv,
 		Local<Function>::Cast(recv->GetInternalField(0));
 
 	Handle<v8::Value> result = DoCall(context, fn, recv, nargs, args, nonatomic);
+	StatsTimer			convert_stats(PLV8_STATS_CONVERT);
 
 	if (result->IsUndefined())
 	{
@@ -1183,6 +3574,11 @@ CallTrigger(PG_FUNCTION_ARGS, plv8_exec_env *xenv)
 	{
 		TupleDesc		tupdesc = RelationGetDescr(rel);
 		Converter		conv(tupdesc);
+		StatsTimer		convert_stats(PLV8_STATS_CONVERT);
+
+		plv8_stats_bytes(trig->tg_trigtuple->t_len);
+		if (TRIGGER_FIRED_BY_UPDATE(event))
+			plv8_stats_bytes(trig->tg_newtuple->t_len);
 
 		if (TRIGGER_FIRED_BY_INSERT(event))
 		{
@@ -1281,9 +3677,11 @@ CallTrigger(PG_FUNCTION_ARGS, plv8_exec_env *xenv)
 	{
 		TupleDesc		tupdesc = RelationGetDescr(rel);
 		Converter		conv(tupdesc);
+		StatsTimer		convert_stats(PLV8_STATS_CONVERT);
 		HeapTupleHeader	header;
 
 		header = DatumGetHeapTupleHeader(conv.ToDatum(newtup));
+		plv8_stats_bytes(HeapTupleHeaderGetDatumLength(header));
 
 		/* We know it's there; heap_form_tuple stores with this layout. */
 		result = PointerGetDatum((char *) header - HEAPTUPLESIZE);
@@ -1300,6 +3698,14 @@ common_pl_call_validator(PG_FUNCTION_ARGS, Dialect dialect) throw()
 	Form_pg_proc	proc;
 	char			functyptype;
 	bool			is_trigger = false;
+	int				nargs;
+	Oid			   *argtypes;
+	char		  **argnames;
+	char		   *argmodes;
+	Datum			prosrc;
+	bool			isnull;
+	char		   *src;
+	char		   *proname;
 
 	if (!CheckFunctionValidatorAccess(fcinfo->flinfo->fn_oid, fn_oid))
 		PG_RETURN_VOID();
@@ -1334,26 +3740,85 @@ common_pl_call_validator(PG_FUNCTION_ARGS, Dialect dialect) throw()
 						format_type_be(proc->prorettype))));
 	}
 
-	ReleaseSysCache(tuple);
+	/*
+	 * Disallow non-polymorphic pseudotypes in arguments (either IN or OUT).
+	 * Internal type is used to declare js functions for find_function().
+	 */
+	nargs = get_func_arg_info(tuple, &argtypes, &argnames, &argmodes);
+	for (int i = 0; i < nargs; i++)
+	{
+		if (get_typtype(argtypes[i]) == TYPTYPE_PSEUDO &&
+				argtypes[i] != INTERNALOID &&
+				!IsPolymorphicType(argtypes[i]))
+			ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("PL/v8 functions cannot accept type %s",
+						format_type_be(argtypes[i]))));
+	}
 
-	try
+	/* pg_restore turns it off, bodies are checked when they are called */
+	if (!check_function_bodies)
 	{
-		current_runtime = GetPlv8Runtime();
-		Isolate::Scope  scope(current_runtime->isolate);
+		ReleaseSysCache(tuple);
+		PG_RETURN_VOID();
+	}
+
+	/*
+	 * Dialects are transpiled by a compiler living in the user's runtime,
+	 * so they are compiled like a call would.
+	 */
+	if (dialect != PLV8_DIALECT_NONE)
+	{
+		ReleaseSysCache(tuple);
+
+		try
+		{
+			current_runtime = GetPlv8Runtime();
+			Isolate::Scope  scope(current_runtime->isolate);
 #ifdef ENABLE_DEBUGGER_SUPPORT
-		Locker				lock;
+			Locker				lock;
 #endif  // ENABLE_DEBUGGER_SUPPORT
-		/* Don't use validator's fcinfo */
-		plv8_proc	   *proc = Compile(fn_oid, NULL,
-									   true, is_trigger, dialect);
-		(void) CreateExecEnv(proc->cache->function, current_runtime);
-		/* the result of a validator is ignored */
-		PG_RETURN_VOID();
+			/* Don't use validator's fcinfo */
+			plv8_proc	   *proc = Compile(fn_oid, NULL,
+										   true, is_trigger, dialect);
+			(void) CreateExecEnv(proc->cache->function, current_runtime);
+			/* the result of a validator is ignored */
+			PG_RETURN_VOID();
+		}
+		catch (js_error& e)	{ e.rethrow(); }
+		catch (pg_error& e)	{ e.rethrow(); }
+	}
+
+	prosrc = SysCacheGetAttr(PROCOID, tuple, Anum_pg_proc_prosrc, &isnull);
+	if (isnull)
+		elog(ERROR, "null prosrc");
+	src = TextDatumGetCString(prosrc);
+	proname = pstrdup(NameStr(proc->proname));
+
+	int	inargs = 0;
+	for (int i = 0; i < nargs; i++)
+	{
+		char	argmode = argmodes ? argmodes[i] : PROARGMODE_IN;
+
+		if (argmode != PROARGMODE_IN &&
+			argmode != PROARGMODE_INOUT &&
+			argmode != PROARGMODE_VARIADIC)
+			continue;
+		if (argnames)
+			argnames[inargs] = argnames[i];
+		inargs++;
+	}
+
+	ReleaseSysCache(tuple);
+
+	try
+	{
+		CheckFunctionSyntax(proname, inargs, (const char **) argnames, src, is_trigger);
 	}
 	catch (js_error& e)	{ e.rethrow(); }
-	catch (pg_error& e)	{ e.rethrow(); }
 
-	return (Datum) 0;	// keep compiler quiet
+	/* the result of a validator is ignored */
+	PG_RETURN_VOID();
 }
 
 Datum
@@ -1387,15 +3852,32 @@ plv8_get_proc(Oid fn_oid, FunctionCallInfo fcinfo, bool validate, char ***argnam
 	MemoryContext		oldcontext;
 	plv8_proc_key		hkey = {};
 
-	procTup = SearchSysCache(PROCOID, ObjectIdGetDatum(fn_oid), 0, 0, 0);
-	if (!HeapTupleIsValid(procTup))
-		elog(ERROR, "cache lookup failed for function %u", fn_oid);
-
 	hkey.fn_oid = fn_oid;
-	hkey.user_id = GetUserId();
+	hkey.user_id = RuntimeOwner(GetUserId());
 	if (plv8_user_context != nullptr && plv8_user_context[0] != '\0') {
 		strlcpy(hkey.user_ctx, plv8_user_context, NAMEDATALEN);
 	}
+
+	/*
+	 * Entries are marked invalid by plv8_proc_invalidate as soon as their
+	 * pg_proc row changes, so a valid compiled entry needs no syscache
+	 * lookup at all.
+	 */
+	if (!plv8_proc_changed.empty())
+		RevalidateProcs();
+	cache = (plv8_proc_cache *)
+		hash_search(plv8_proc_cache_hash, &hkey, HASH_FIND, NULL);
+	if (cache != NULL && cache->valid && !cache->function.IsEmpty())
+	{
+		dlist_move_head(&plv8_proc_lru, &cache->lru_node);
+		plv8_proc_hits++;
+		return plv8_new_proc(cache, fcinfo);
+	}
+
+	procTup = SearchSysCache(PROCOID, ObjectIdGetDatum(fn_oid), 0, 0, 0);
+	if (!HeapTupleIsValid(procTup))
+		elog(ERROR, "cache lookup failed for function %u", fn_oid);
+
 	cache = (plv8_proc_cache *)
 		hash_search(plv8_proc_cache_hash, &hkey, HASH_ENTER, &found);
 
@@ -1415,22 +3897,42 @@ plv8_get_proc(Oid fn_oid, FunctionCallInfo fcinfo, bool validate, char ***argnam
 
 		if (!uptodate)
 		{
-			if (cache->prosrc)
-			{
-				pfree(cache->prosrc);
-				cache->prosrc = NULL;
-			}
-			cache->function.Reset();
+			// evicted functions are compiled again from the compile cache
+			if (!cache->function.IsEmpty())
+				DropCompiled(cache->fn_hashvalue);
+			ReleaseProc(cache);
 		}
 		else
 		{
 			ReleaseSysCache(procTup);
+			cache->valid = true;
+			dlist_move_head(&plv8_proc_lru, &cache->lru_node);
+			plv8_proc_hits++;
 		}
 	}
 	else
 	{
+		plv8_proc_context_key	ckey = {};
+		plv8_proc_context	   *ctx;
+		bool					ctx_found;
+
 		new(&cache->function) Persistent<Function>();
+		cache->xenv = NULL;
 		cache->prosrc = NULL;
+		cache->code_size = 0;
+		cache->pinned = false;
+		cache->valid = false;
+		cache->fn_own = false;
+		cache->fn_hashvalue = GetSysCacheHashValue1(PROCOID, ObjectIdGetDatum(fn_oid));
+		IndexProc(cache);
+
+		ckey.user_id = hkey.user_id;
+		strlcpy(ckey.user_ctx, hkey.user_ctx, NAMEDATALEN);
+		ctx = (plv8_proc_context *)
+			hash_search(plv8_proc_context_hash, &ckey, HASH_ENTER, &ctx_found);
+		if (!ctx_found)
+			dlist_init(&ctx->procs);
+		dlist_push_tail(&ctx->procs, &cache->ctx_node);
 	}
 
 	if (cache->function.IsEmpty())
@@ -1449,6 +3951,9 @@ plv8_get_proc(Oid fn_oid, FunctionCallInfo fcinfo, bool validate, char ***argnam
 		strlcpy(cache->proname, NameStr(procStruct->proname), NAMEDATALEN);
 		cache->fn_xmin = HeapTupleHeaderGetXmin(procTup->t_data);
 		cache->fn_tid = procTup->t_self;
+		cache->fn_own = TransactionIdIsCurrentTransactionId(cache->fn_xmin);
+		/* an invalidation arriving from here on clears it again */
+		cache->valid = true;
 
 		int nargs = get_func_arg_info(procTup, &argtypes, argnames, &argmodes);
 
@@ -1501,6 +4006,16 @@ plv8_get_proc(Oid fn_oid, FunctionCallInfo fcinfo, bool validate, char ***argnam
 		cache->nargs = inargs;
 	}
 
+	return plv8_new_proc(cache, fcinfo);
+}
+
+/*
+ * Build the per call site plv8_proc for a proc cache entry, resolving
+ * polymorphic types if this is an actual call.
+ */
+static plv8_proc *
+plv8_new_proc(plv8_proc_cache *cache, FunctionCallInfo fcinfo)
+{
 	MemoryContext mcxt = CurrentMemoryContext;
 	if (fcinfo)
 		mcxt = fcinfo->flinfo->fn_mcxt;
@@ -1543,14 +4058,7 @@ CreateExecEnv(Persistent<Function>& function, plv8_runtime *runtime)
 	}
 	PG_END_TRY();
 
-	Local<Context>		ctx = current_runtime->localContext();
-	Context::Scope		scope(ctx);
-
-	Local<ObjectTemplate> templ = Local<ObjectTemplate>::New(runtime->isolate, runtime->recv_templ);
-	Local<Object> obj = templ->NewInstance(ctx).ToLocalChecked();
-	Local<Function> f = Local<Function>::New(runtime->isolate, function);
-	obj->SetInternalField(0, f);
-	xenv->recv.Reset(runtime->isolate, obj);
+	InitExecEnv(xenv, Local<Function>::New(runtime->isolate, function), runtime);
 
 	return xenv;
 }
@@ -1572,21 +4080,143 @@ CreateExecEnv(Handle<Function> function, plv8_runtime *runtime)
 	}
 	PG_END_TRY();
 
+	InitExecEnv(xenv, Local<Function>::New(runtime->isolate, function), runtime);
+
+	return xenv;
+}
+
+/*
+ * The receiver of a function is kept in its proc cache entry, so neither
+ * it nor what the function keeps in `this` has to be set up again in the
+ * next transaction.  It goes away with the compiled function.
+ */
+static plv8_exec_env *
+GetExecEnv(plv8_proc_cache *cache, plv8_runtime *runtime)
+{
+	plv8_exec_env	   *xenv;
+	HandleScope			handle_scope(runtime->isolate);
+
+	if (cache->xenv != NULL)
+	{
+		if (cache->xenv->abort_generation == plv8_abort_generation)
+			return cache->xenv;
+		ReleaseExecEnv(cache);
+	}
+
+	PG_TRY();
+	{
+		xenv = (plv8_exec_env *)
+			MemoryContextAllocZero(TopMemoryContext, sizeof(plv8_exec_env));
+	}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
+
+	new(&xenv->recv) Persistent<Object>();
+	xenv->isolate = runtime->isolate;
+	xenv->persistent = true;
+	xenv->abort_generation = plv8_abort_generation;
+	InitExecEnv(xenv, Local<Function>::New(runtime->isolate, cache->function), runtime);
+	cache->xenv = xenv;
+
+	return xenv;
+}
+
+static void
+InitExecEnv(plv8_exec_env *xenv, Local<Function> function, plv8_runtime *runtime)
+{
 	Local<Context>		ctx = current_runtime->localContext();
 	Context::Scope		scope(ctx);
 
 	Local<ObjectTemplate> templ = Local<ObjectTemplate>::New(runtime->isolate, runtime->recv_templ);
 	Local<Object> obj = templ->NewInstance(ctx).ToLocalChecked();
-	Local<Function> f = Local<Function>::New(runtime->isolate, function);
-	obj->SetInternalField(0, f);
+	obj->SetInternalField(0, function);
 	xenv->recv.Reset(runtime->isolate, obj);
+}
 
-	return xenv;
+/*
+ * Look up a compilation result, nullptr if it is not cached.
+ */
+static const std::string *
+FindCompiled(const std::string &key)
+{
+	auto	it = CompileCache.find(key);
+
+	if (it == CompileCache.end())
+		return nullptr;
+	CompileLRU.splice(CompileLRU.begin(), CompileLRU, it->second.lru);
+	compile_cache_hits++;
+	return &it->second.data;
 }
 
-/* Source transformation from a dialect (coffee or ls) to js */
-static char *
-CompileDialect(const char *src, Dialect dialect, plv8_runtime *runtime)
+/*
+ * Keep a compilation result within plv8.compile_cache_budget, releasing the
+ * least recently used first.  fn_hashvalue identifies the pg_proc entry the
+ * result was compiled for, if any.
+ */
+static const std::string &
+CacheCompiled(std::string &&key, const char *data, size_t len, uint32 fn_hashvalue)
+{
+	auto	entry = CompileCache.find(key);
+
+	if (entry != CompileCache.end())
+	{
+		compile_cache_size -= entry->second.data.size();
+		CompileLRU.splice(CompileLRU.begin(), CompileLRU, entry->second.lru);
+	}
+	else
+	{
+		entry = CompileCache.emplace(std::move(key), plv8_compile_entry()).first;
+		CompileLRU.push_front(&entry->first);
+		entry->second.lru = CompileLRU.begin();
+		compile_cache_size += entry->first.size();
+	}
+	entry->second.data.assign(data, len);
+	entry->second.fn_hashvalue = fn_hashvalue;
+	compile_cache_size += len;
+
+	while (CompileLRU.size() > 1 && plv8_compile_cache_budget > 0 &&
+		   compile_cache_size > (size_t) plv8_compile_cache_budget * 1_MB)
+	{
+		auto	victim = CompileCache.find(*CompileLRU.back());
+
+		compile_cache_size -= victim->first.size() + victim->second.data.size();
+		CompileLRU.pop_back();
+		CompileCache.erase(victim);
+	}
+
+	return entry->second.data;
+}
+
+/*
+ * Release the compilation results of a pg_proc entry which changed.
+ */
+static void
+DropCompiled(uint32 fn_hashvalue)
+{
+	for (auto it = CompileLRU.begin(); it != CompileLRU.end();)
+	{
+		auto	entry = CompileCache.find(**it);
+
+		if (entry->second.fn_hashvalue != fn_hashvalue)
+		{
+			++it;
+			continue;
+		}
+		compile_cache_size -= entry->first.size() + entry->second.data.size();
+		it = CompileLRU.erase(it);
+		CompileCache.erase(entry);
+	}
+}
+
+/*
+ * Source transformation from a dialect (coffee or ls) to js.  The result
+ * is owned by the compile cache, and only valid until the next call.
+ */
+static const char *
+CompileDialect(const char *src, Dialect dialect, plv8_runtime *runtime, uint32 fn_hashvalue)
 {
 	Isolate		   *isolate = Isolate::GetCurrent();
 	HandleScope		handle_scope(isolate);
@@ -1594,11 +4224,16 @@ CompileDialect(const char *src, Dialect dialect, plv8_runtime *runtime)
 	Context::Scope	context_scope(ctx);
 	TryCatch		try_catch(isolate);
 	Local<String>	key;
-	char		   *cresult;
 	const char	   *dialect_binary_data;
+	std::string		cache_key(1, static_cast<char>('0' + dialect));
 
 	CheckTermination(isolate);
 
+	cache_key.append(src);
+	const std::string  *cached = FindCompiled(cache_key);
+	if (cached != nullptr)
+		return cached->c_str();
+
 	switch (dialect)
 	{
 		case PLV8_DIALECT_COFFEE:
@@ -1619,12 +4254,29 @@ CompileDialect(const char *src, Dialect dialect, plv8_runtime *runtime)
 
 	if (ctx->Global()->Get(ctx, key).ToLocalChecked()->IsUndefined())
 	{
+		std::string		   &code_cache = dialect_code_cache[dialect];
 		v8::ScriptOrigin origin(key);
+		ScriptCompiler::Source source(ToString(dialect_binary_data), origin,
+									  code_cache.empty() ? nullptr :
+									  new ScriptCompiler::CachedData((const uint8_t *) code_cache.data(),
+																	 code_cache.size()));
 		v8::Local<v8::Script> script;
-		if (!Script::Compile(isolate->GetCurrentContext(), ToString(dialect_binary_data), &origin).ToLocal(&script))
+		if (!ScriptCompiler::Compile(isolate->GetCurrentContext(), &source,
+									 code_cache.empty() ? ScriptCompiler::kNoCompileOptions :
+									 ScriptCompiler::kConsumeCodeCache).ToLocal(&script))
 			throw js_error(try_catch);
 		if (script.IsEmpty())
 			throw js_error(try_catch);
+		if (!code_cache.empty())
+		{
+			if (source.GetCachedData()->rejected)
+			{
+				compiler_cache_rejected++;
+				code_cache.clear();
+			}
+			else
+				compiler_cache_hits++;
+		}
 		v8::Local<v8::Value> result;
 		if (!script->Run(isolate->GetCurrentContext()).ToLocal(&result))
 			throw js_error(try_catch);
@@ -1640,6 +4292,14 @@ CompileDialect(const char *src, Dialect dialect, plv8_runtime *runtime)
 			}
 			throw js_error(try_catch);
 		}
+		// after running it, so that the functions compiled lazily are included
+		if (code_cache.empty())
+		{
+			std::unique_ptr<ScriptCompiler::CachedData> data(
+				ScriptCompiler::CreateCodeCache(script->GetUnboundScript()));
+			if (data)
+				code_cache.assign((const char *) data->data, data->length);
+		}
 	}
 
 	Local<Object> compiler = Local<Object>::Cast(ctx->Global()->Get(ctx, key).ToLocalChecked());
@@ -1666,19 +4326,9 @@ CompileDialect(const char *src, Dialect dialect, plv8_runtime *runtime)
 	}
 	CString		result(value.ToLocalChecked());
 
-	PG_TRY();
-	{
-		MemoryContext	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
-		cresult = pstrdup(result.str());
-		MemoryContextSwitchTo(oldcontext);
-	}
-	PG_CATCH();
-	{
-		throw pg_error();
-	}
-	PG_END_TRY();
+	const char *js = result.str("");
 
-	return cresult;
+	return CacheCompiled(std::move(cache_key), js, strlen(js), fn_hashvalue).c_str();
 }
 
 /*
@@ -1687,7 +4337,7 @@ CompileDialect(const char *src, Dialect dialect, plv8_runtime *runtime)
  */
 static plv8_proc *
 Compile(Oid fn_oid, FunctionCallInfo fcinfo, bool validate, bool is_trigger,
-		Dialect dialect)
+		Dialect dialect, bool eager)
 {
 	plv8_proc  *proc;
 	char	  **argnames;
@@ -1718,6 +4368,7 @@ Compile(Oid fn_oid, FunctionCallInfo fcinfo, bool validate, bool is_trigger,
 		current_runtime = GetPlv8Runtime();
 		Isolate::Scope	scope(current_runtime->isolate);
 		HandleScope		handle_scope(current_runtime->isolate);
+		StatsTimer		compile_stats(PLV8_STATS_COMPILE, fn_oid);
 		cache->function.Reset(current_runtime->isolate, CompileFunction(
 						current_runtime,
 						cache->proname,
@@ -1726,182 +4377,256 @@ Compile(Oid fn_oid, FunctionCallInfo fcinfo, bool validate, bool is_trigger,
 						cache->prosrc,
 						is_trigger,
 						cache->retset,
-						dialect));
+						dialect,
+						eager,
+						cache->fn_hashvalue));
+		CacheProc(cache);
+		plv8_proc_misses++;
 	}
 
 	return proc;
 }
 
-static Local<Function>
-CompileFunction(
-	plv8_runtime *runtime,
-	const char *proname,
-	int proarglen,
-	const char *proargs[],
-	const char *prosrc,
-	bool is_trigger,
-	bool retset,
-	Dialect dialect)
+/*
+ * Compile prosrc as the body of a function, without wrapping it in a script.
+ * Lines are numbered from the line after the function header, as users
+ * expect.  With code_cache, the function is compiled from the V8 code cache
+ * of an identical function compiled earlier by any runtime of the backend,
+ * or one is produced for the next time.
+ */
+static MaybeLocal<Function>
+CompileFunctionBody(Local<Context> context, const char *proname,
+					int proarglen, const char *proargs[],
+					const char *prosrc, bool is_trigger,
+					bool eager, bool code_cache, uint32 fn_hashvalue)
 {
-	Isolate					   *isolate = Isolate::GetCurrent();
+	static const char  *trigger_args[] = {
+		"NEW", "OLD", "TG_NAME", "TG_WHEN", "TG_LEVEL", "TG_OP",
+		"TG_RELID", "TG_TABLE_NAME", "TG_TABLE_SCHEMA", "TG_ARGV"
+	};
+	Isolate					   *isolate = context->GetIsolate();
 	EscapableHandleScope		handle_scope(isolate);
-	StringInfoData	src;
+	std::vector<Local<String>>	args;
+	std::string					key(1, 'c');
 
-	initStringInfo(&src);
-
-	if (dialect != PLV8_DIALECT_NONE)
-		prosrc = CompileDialect(prosrc, dialect, runtime);
-	/*
-	 *  (function (<arg1, ...>){
-	 *    <prosrc>
-	 *  })
-	 */
-	appendStringInfo(&src, "(function (");
 	if (is_trigger)
 	{
 		if (proarglen != 0)
 			throw js_error("trigger function cannot have arguments");
-		// trigger function has special arguments.
-		appendStringInfo(&src,
-			"NEW, OLD, TG_NAME, TG_WHEN, TG_LEVEL, TG_OP, "
-			"TG_RELID, TG_TABLE_NAME, TG_TABLE_SCHEMA, TG_ARGV");
+		for (auto name: trigger_args)
+		{
+			args.push_back(ToString(name));
+			key.append(name).push_back(',');
+		}
 	}
 	else
 	{
 		for (int i = 0; i < proarglen; i++)
 		{
-			if (i > 0)
-				appendStringInfoChar(&src, ',');
-			if (proargs && proargs[i])
-				appendStringInfoString(&src, proargs[i]);
+			char	name[16];
+			const char *argname = name;
+
+			if (proargs && proargs[i] && proargs[i][0] != '\0')
+				argname = proargs[i];
 			else
-				appendStringInfo(&src, "$%d", i + 1);	// unnamed argument to $N
+				snprintf(name, sizeof(name), "$%d", i + 1);	// unnamed argument to $N
+			args.push_back(ToString(argname));
+			key.append(argname).push_back(',');
 		}
 	}
-	if (dialect)
-		appendStringInfo(&src, "){\nreturn %s\n})", prosrc);
-	else
-		appendStringInfo(&src, "){\n%s\n})", prosrc);
 
-	Handle<v8::Value> name;
+	Local<v8::Value>	name;
 	if (proname)
 		name = ToString(proname);
 	else
 		name = Undefined(isolate);
-	Local<String> source = ToString(src.data, src.len);
-	pfree(src.data);
+	v8::ScriptOrigin	origin(name, Integer::New(isolate, 1));
+	const std::string  *cached = nullptr;
+	ScriptCompiler::CompileOptions	options = eager ? ScriptCompiler::kEagerCompile :
+												  ScriptCompiler::kNoCompileOptions;
 
-	Local<Context>	context = runtime->localContext();
-	Context::Scope	context_scope(context);
-	TryCatch		try_catch(isolate);
-	v8::ScriptOrigin origin(name);
+	if (code_cache)
+	{
+		key.push_back('\0');
+		key.append(prosrc);
+		cached = FindCompiled(key);
+		if (cached != nullptr)
+			options = ScriptCompiler::kConsumeCodeCache;
+	}
 
-	// set up the signal handlers
-	int_handler = (void *) signal(SIGINT, signal_handler);
-	term_handler = (void *) signal(SIGTERM, signal_handler);
+	// the source owns the cached data object, not the buffer
+	ScriptCompiler::Source	source(ToString(prosrc), origin,
+								   cached == nullptr ? nullptr :
+								   new ScriptCompiler::CachedData((const uint8_t *) cached->data(),
+																  cached->size()));
+	Local<Function>			function;
 
-#ifdef EXECUTION_TIMEOUT
-	bool timeout = false;
-#ifdef _MSC_VER // windows
-	HANDLE  hThread;
-	DWORD dwThreadId;
-	hThread = CreateThread(NULL, 0, Breakout, isolate, 0, &dwThreadId);
-#else
-	pthread_t breakout_thread;
-	// set up the thread to break out the execution if needed
-	pthread_create(&breakout_thread, NULL, Breakout, isolate);
-#endif
-#endif
+	if (!ScriptCompiler::CompileFunctionInContext(context, &source, args.size(), args.data(),
+												  0, nullptr, options).ToLocal(&function))
+		return MaybeLocal<Function>();
 
-	v8::Local<v8::Script> script;
-	v8::Local<v8::Value> result;
-	if (Script::Compile(context, source, &origin).ToLocal(&script)) {
-		if (!script.IsEmpty()) {
-			if (!script->Run(context).ToLocal(&result))
-				throw js_error(try_catch);
-		}
+	if (code_cache && (cached == nullptr || source.GetCachedData()->rejected))
+	{
+		std::unique_ptr<ScriptCompiler::CachedData> data(
+			ScriptCompiler::CreateCodeCacheForFunction(function));
+		if (data)
+			CacheCompiled(std::move(key), (const char *) data->data, data->length, fn_hashvalue);
+	}
+
+	return handle_scope.Escape(function);
+}
+
+static void
+ValidatorOOMErrorHandler(const char* location, bool is_heap_oom)
+{
+	validator_isolate->TerminateExecution();
+	validator_isolate_dead = true;
+	// see OOMErrorHandler()
+	elog(ERROR, "out of memory");
+}
+
+/*
+ * Check the syntax of a plv8 function in the validator isolate, created
+ * on first use and again after running out of memory.
+ */
+static void
+CheckFunctionSyntax(const char *proname, int proarglen, const char *proargs[],
+					const char *prosrc, bool is_trigger)
+{
+	if (validator_isolate != nullptr && validator_isolate_dead)
+	{
+		// ValidatorOOMErrorHandler() jumped over the Isolate::Scope
+		if (validator_isolate->IsInUse())
+			validator_isolate->Exit();
+		validator_context.Reset();
+		validator_isolate->Dispose();
+		delete validator_allocator;
+		validator_isolate = nullptr;
+		validator_isolate_dead = false;
+	}
+
+	if (validator_isolate == nullptr)
+	{
+		Isolate::CreateParams	params;
+		ResourceConstraints		rc;
+
+		InitializeV8();
+
+		validator_allocator = ArrayBuffer::Allocator::NewDefaultAllocator();
+		params.array_buffer_allocator = validator_allocator;
+		rc.ConfigureDefaults(plv8_memory_limit * 1_MB * 2, plv8_memory_limit * 1_MB * 2);
+		params.constraints = rc;
+		validator_isolate = Isolate::New(params);
+		validator_isolate->SetOOMErrorHandler(ValidatorOOMErrorHandler);
+
+		Isolate::Scope		scope(validator_isolate);
+		HandleScope			handle_scope(validator_isolate);
+		validator_context.Reset(validator_isolate, Context::New(validator_isolate));
+	}
+
+	Isolate::Scope		scope(validator_isolate);
+	HandleScope			handle_scope(validator_isolate);
+	Local<Context>		context = validator_context.Get(validator_isolate);
+	Context::Scope		context_scope(context);
+	TryCatch			try_catch(validator_isolate);
+
+	if (CompileFunctionBody(context, proname, proarglen, proargs, prosrc,
+							is_trigger, false, false).IsEmpty())
+		throw js_error(try_catch);
+}
+
+static Local<Function>
+CompileFunction(
+	plv8_runtime *runtime,
+	const char *proname,
+	int proarglen,
+	const char *proargs[],
+	const char *prosrc,
+	bool is_trigger,
+	bool retset,
+	Dialect dialect,
+	bool eager,
+	uint32 fn_hashvalue)
+{
+	Isolate					   *isolate = Isolate::GetCurrent();
+	EscapableHandleScope		handle_scope(isolate);
+	StringInfoData				src;
+
+	/*
+	 * The body is compiled as a function taking the arguments, dialects
+	 * returning the value of their transpiled expression.
+	 */
+	if (dialect != PLV8_DIALECT_NONE)
+	{
+		initStringInfo(&src);
+		appendStringInfo(&src, "return %s", CompileDialect(prosrc, dialect, runtime, fn_hashvalue));
+		prosrc = src.data;
 	}
 
-#ifdef EXECUTION_TIMEOUT
-#ifdef _MSC_VER
-	if (TerminateThread(hThread, NULL) == 0) {
-		timeout = true;
-	}
-#else
-	void *thread_result;
-	pthread_cancel(breakout_thread);
-	pthread_join(breakout_thread, &thread_result);
-	if (thread_result == NULL) {
-		timeout = true;
-	}
-#endif
-#endif
-	signal(SIGINT, (void (*)(int)) int_handler);
-	signal(SIGTERM, (void (*)(int)) term_handler);
+	Local<Context>	context = runtime->localContext();
+	Context::Scope	context_scope(context);
+	TryCatch		try_catch(isolate);
+	Local<Function>	function;
 
-	if (result.IsEmpty()) {
+	CheckTermination(isolate);
+
+	if (!CompileFunctionBody(context, proname, proarglen, proargs, prosrc,
+							 is_trigger, eager, true, fn_hashvalue).ToLocal(&function))
+	{
 		if (CheckTermination(isolate))
-		{
-			if (current_runtime->interrupted) {
-				current_runtime->interrupted = false;
-				throw js_error("Signal caught: interrupted");
-			}
-#ifdef EXECUTION_TIMEOUT
-			if (timeout)
-				throw js_error("compiler timeout exceeded");
-#endif
 			throw js_error("Script is out of memory");
-		}
 		throw js_error(try_catch);
 	}
+	if (dialect != PLV8_DIALECT_NONE)
+		pfree(src.data);
 
-	return handle_scope.Escape(Local<Function>::Cast(result));
+	return handle_scope.Escape(function);
 }
 
-Local<Function>
-find_js_function(Oid fn_oid)
+/*
+ * The dialect of a function, or -1 if it is not written in one of the
+ * PLV8 languages.  The language oids are resolved once, and again after
+ * pg_language changed.
+ */
+static int
+FindJsLanguage(Oid fn_oid)
 {
-	HeapTuple		tuple;
-	Form_pg_proc	pg_proc;
-	Oid				prolang;
-	NameData		langnames[] = { {"plv8"}, {"plcoffee"}, {"plls"} };
-	int				langno;
-	int				langlen = sizeof(langnames) / sizeof(NameData);
-	Local<Function> func;
-	Isolate			*isolate = Isolate::GetCurrent();
+	static const char  *langnames[] = { "plv8", "plcoffee", "plls" };
+	HeapTuple			tuple;
+	Oid					prolang;
+	int					langno;
 
 	tuple = SearchSysCache(PROCOID, ObjectIdGetDatum(fn_oid), 0, 0, 0);
 	if (!HeapTupleIsValid(tuple))
 		elog(ERROR, "cache lookup failed for function %u", fn_oid);
-	pg_proc = (Form_pg_proc) GETSTRUCT(tuple);
-	prolang = pg_proc->prolang;
+	prolang = ((Form_pg_proc) GETSTRUCT(tuple))->prolang;
 	ReleaseSysCache(tuple);
 
 	/* Should not happen? */
 	if (!OidIsValid(prolang))
-		return func;
+		return -1;
+
+	if (!plv8_lang_oids_valid)
+	{
+		for (langno = 0; langno < PLV8_LANGUAGES; langno++)
+			plv8_lang_oids[langno] = get_language_oid(langnames[langno], true);
+		plv8_lang_oids_valid = true;
+	}
 
 	/* See if the function language is a compatible one */
-	for (langno = 0; langno < langlen; langno++)
+	for (langno = 0; langno < PLV8_LANGUAGES; langno++)
 	{
-		tuple = SearchSysCache(LANGNAME, NameGetDatum(&langnames[langno]), 0, 0, 0);
-		if (HeapTupleIsValid(tuple))
-		{
-#if PG_VERSION_NUM < 120000
-			Oid langtupoid = HeapTupleGetOid(tuple);
-#else
-			Form_pg_database datForm = (Form_pg_database) GETSTRUCT(tuple);
-			Oid langtupoid = datForm->oid;
-#endif
-			ReleaseSysCache(tuple);
-			if (langtupoid == prolang)
-				break;
-		}
+		if (plv8_lang_oids[langno] == prolang)
+			return langno;
 	}
+	return -1;
+}
 
-	/* Not found or non-JS function */
-	if (langno >= langlen)
-		return func;
+static Local<Function>
+GetJsFunction(Oid fn_oid, int langno)
+{
+	Local<Function> func;
+	Isolate			*isolate = Isolate::GetCurrent();
 
 	try
 	{
@@ -1919,6 +4644,79 @@ find_js_function(Oid fn_oid)
 	return func;
 }
 
+Local<Function>
+find_js_function(Oid fn_oid)
+{
+	Local<Function> func;
+	int				langno = FindJsLanguage(fn_oid);
+
+	/* Not found or non-JS function */
+	if (langno < 0)
+		return func;
+
+	return GetJsFunction(fn_oid, langno);
+}
+
+/*
+ * plv8.find_function() resolution, cached by user and signature along with
+ * the search_path it was resolved with.  The whole cache goes stale when a
+ * function, language, role, role membership or schema changes, and starts
+ * over once it holds FIND_FUNCTION_CACHE_SIZE signatures.
+ */
+Local<Function>
+find_js_function_by_name(const char *signature)
+{
+	Local<Function>		func;
+	std::string			key = std::to_string(GetUserId()) + ":" + signature;
+
+	if (plv8_find_function_generation != plv8_find_function_cache_generation)
+	{
+		FindFunctionCache.clear();
+		plv8_find_function_cache_generation = plv8_find_function_generation;
+	}
+
+	auto	it = FindFunctionCache.find(key);
+	if (it == FindFunctionCache.end() || it->second.search_path != namespace_search_path)
+	{
+		plv8_find_function_entry	entry;
+
+		if (strchr(signature, '(') == NULL)
+			entry.fn_oid = DatumGetObjectId(
+					DirectFunctionCall1(regprocin, CStringGetDatum(signature)));
+		else
+			entry.fn_oid = DatumGetObjectId(
+					DirectFunctionCall1(regprocedurein, CStringGetDatum(signature)));
+#if PG_VERSION_NUM >= 160000
+		entry.allowed = object_aclcheck(ProcedureRelationId, entry.fn_oid,
+										GetUserId(), ACL_EXECUTE) == ACLCHECK_OK;
+#else
+		entry.allowed = pg_proc_aclcheck(entry.fn_oid, GetUserId(), ACL_EXECUTE) == ACLCHECK_OK;
+#endif
+		entry.langno = entry.allowed ? FindJsLanguage(entry.fn_oid) : -1;
+		entry.search_path = namespace_search_path;
+		// signatures built at run time could grow it without bounds
+		if (FindFunctionCache.size() >= FIND_FUNCTION_CACHE_SIZE)
+			FindFunctionCache.clear();
+		FindFunctionCache[key] = entry;
+		it = FindFunctionCache.find(key);
+	}
+
+	// compiling may run the start proc, which may come back here
+	Oid		fn_oid = it->second.fn_oid;
+	int		langno = it->second.langno;
+
+	if (!it->second.allowed)
+	{
+		elog(WARNING, "failed to find or no permission for js function %s", signature);
+		return func;
+	}
+	if (langno >= 0)
+		func = GetJsFunction(fn_oid, langno);
+	if (func.IsEmpty())
+		elog(ERROR, "javascript function is not found for \"%s\"", signature);
+	return func;
+}
+
 /*
  * NOTICE: the returned buffer could be an internal static buffer.
  */
@@ -2070,7 +4868,7 @@ static void RunStartProc(plv8_runtime *runtime) {
 
 static plv8_runtime*
 GetPlv8Runtime() {
-	Oid					user_id = GetUserId();
+	Oid					user_id = RuntimeOwner(GetUserId());
 	plv8_runtime		*runtime = nullptr;
 
 	// shortcut: use current_runtime if it's the same user and not dead
@@ -2078,36 +4876,51 @@ GetPlv8Runtime() {
 		runtime = current_runtime;
 	else
 	{
-		unsigned int	i;
-		for (i = 0; i < RuntimeCache.size(); i++)
+		auto	it = RuntimeIndex.find(user_id);
+		if (it != RuntimeIndex.end())
 		{
-			if (RuntimeCache[i]->user_id == user_id)
-			{
-				runtime = RuntimeCache[i];
-				break;
-			}
+			runtime = *it->second;
+			// move it to the front of the LRU list
+			RuntimeCache.splice(RuntimeCache.begin(), RuntimeCache, it->second);
+			plv8_runtime_hits++;
 		}
+		else
+			plv8_runtime_misses++;
+		uint64	heap_limit_recovered = 0;
+		uint64	heap_limit_killed = 0;
 		if (runtime != nullptr && runtime->wasKilled())
 		{
 			// the isolate is dead because of OOM, kill it and dispose
 			char *username = GetUserNameFromId(runtime->user_id, false);
 			elog(LOG_SERVER_ONLY, "Disposing of a dead isolate for: %s", username);
-			RuntimeCache.erase(RuntimeCache.begin() + i);
 			if (runtime->isolate && runtime->isolate->IsInUse())
 				runtime->isolate->Exit();
-			if (current_runtime == runtime)
-				current_runtime = nullptr;
-			ClearProcCache(runtime);
-			KillRuntime(runtime);
-			pfree(runtime);
+			// keep the counters for the user's next runtime
+			heap_limit_recovered = runtime->heap_limit_recovered;
+			heap_limit_killed = runtime->heap_limit_killed;
+			DisposeRuntime(runtime);
 			runtime = nullptr;
 		}
 		if (runtime == nullptr) // need to create a new runtime
 		{
+			EvictRuntimes();
 			runtime = (plv8_runtime *) MemoryContextAlloc(TopMemoryContext,
 														  sizeof(plv8_runtime));
 			runtime->is_dead = false;
 			runtime->interrupted = false;
+			runtime->heap_limit_hit = false;
+			runtime->heap_limit_raised = false;
+			runtime->initial_heap_limit = 0;
+			runtime->heap_limit_recovered = heap_limit_recovered;
+			runtime->heap_limit_killed = heap_limit_killed;
+			runtime->idle_gc = false;
+			runtime->idle_since = 0;
+			runtime->idle_gc_heap = 0;
+			runtime->reset_pending = false;
+			memset(&runtime->gc_stats, 0, sizeof(runtime->gc_stats));
+			runtime->profiler = nullptr;
+			runtime->profiling = false;
+			runtime->call_profiling = false;
 			runtime->user_id = user_id;
 			CreateIsolate(runtime);
 			Isolate 			   *isolate = runtime->isolate;
@@ -2160,15 +4973,38 @@ GetPlv8Runtime() {
 			SetupWindowFunctions(templ);
 			runtime->window_template.Reset(isolate, templ);
 
-			new(&runtime->ctx_queue) std::list<std::tuple<std::string, v8::Global<v8::Context>>>();
+			new(&runtime->hashmap_template) Persistent<ObjectTemplate>();
+			base = FunctionTemplate::New(isolate);
+			Local<String> hashmapClassName = String::NewFromUtf8Literal(isolate, "HashMap",
+																		NewStringType::kInternalized);
+			base->SetClassName(hashmapClassName);
+			base->PrototypeTemplate()->Set(toStringSymbol, hashmapClassName, toStringAttr);
+			templ = base->InstanceTemplate();
+			SetupHashMapFunctions(templ);
+			runtime->hashmap_template.Reset(isolate, templ);
+			runtime->hashmap_context = nullptr;
+
+			new(&runtime->ctx_queue) std::list<std::tuple<std::string, v8::Global<v8::Context>, size_t, TimestampTz>>();
 			new(&runtime->ctx_map) std::unordered_map<std::string, std::list<std::tuple<std::string,
-					v8::Global<v8::Context>>>::iterator>();
+					v8::Global<v8::Context>, size_t, TimestampTz>>::iterator>();
+			runtime->measure_pending = false;
+			new(&runtime->ctx_stats) std::unordered_map<std::string, plv8_context_stats>();
+			new(&runtime->eval_map) std::unordered_map<std::string, plv8_eval_entry>();
+			new(&runtime->eval_lru) std::list<const std::string *>();
+			runtime->eval_size = 0;
+			runtime->eval_hits = 0;
+			runtime->eval_misses = 0;
+			runtime->eval_evicted = 0;
+			new(&runtime->module_map) std::unordered_map<std::string, v8::Global<v8::Module>>();
+			runtime->module_generation = plv8_es_modules_generation;
 
 			/*
 			 * Need to register it before running any code, as the code
 			 * recursively may want to get the runtime.
 			 */
-			RuntimeCache.push_back(runtime);
+			RuntimeCache.push_front(runtime);
+			RuntimeIndex[user_id] = RuntimeCache.begin();
+			plv8_runtimes_created++;
 
 #ifdef ENABLE_DEBUGGER_SUPPORT
 			debug_message_context = v8::Persistent<v8::Context>::New(global_context);
@@ -2181,6 +5017,17 @@ GetPlv8Runtime() {
 #endif  // ENABLE_DEBUGGER_SUPPORT
 		}
 	}
+	return ActivateRuntime(runtime);
+}
+
+/*
+ * Get the runtime ready for a call in the current plv8.context.
+ */
+static plv8_runtime *
+ActivateRuntime(plv8_runtime *runtime)
+{
+	if (runtime->idle_since != 0)
+		IdleGC(runtime);
 	if (plv8_user_context == nullptr || plv8_user_context[0] == '\0')
 	{
 		if (runtime->default_context.IsEmpty())
@@ -2193,6 +5040,7 @@ GetPlv8Runtime() {
 	}
 	else
 		runtime->touchContext(plv8_user_context);
+	runtime->idle_gc = true;
 	return runtime;
 }
 
@@ -2250,9 +5098,44 @@ static bool CheckTermination (Isolate *isolate) {
 	if (wasTerminating)
 		// it just means we got control back and are ready to send new code to the isolate
 		isolate->CancelTerminateExecution();
+	if (current_runtime != nullptr && current_runtime->isolate == isolate
+		&& current_runtime->heap_limit_hit)
+		RecoverHeapLimit(current_runtime);
 	return wasTerminating;
 }
 
+/*
+ * Called once a call terminated for hitting the heap limit has unwound.
+ * Collect what the call left behind and lower the heap limit again, the
+ * runtime is only disposed if the memory can't be reclaimed.
+ */
+static void
+RecoverHeapLimit(plv8_runtime *runtime)
+{
+	Isolate		   *isolate = runtime->isolate;
+	HeapStatistics	heap_statistics;
+
+	runtime->heap_limit_hit = false;
+	isolate->LowMemoryNotification();
+	isolate->GetHeapStatistics(&heap_statistics);
+
+	if (heap_statistics.used_heap_size() > plv8_memory_limit * 1_MB)
+	{
+		elog(LOG_SERVER_ONLY, "plv8: could not reclaim memory, disposing of the isolate");
+		runtime->is_dead = true;
+		runtime->heap_limit_killed++;
+		return;
+	}
+
+	if (runtime->heap_limit_raised)
+	{
+		isolate->RemoveNearHeapLimitCallback(NearHeapLimitHandler, runtime->initial_heap_limit);
+		isolate->AddNearHeapLimitCallback(NearHeapLimitHandler, runtime);
+		runtime->heap_limit_raised = false;
+	}
+	runtime->heap_limit_recovered++;
+}
+
 /*
  * Accessor to plv8_type stored in fcinfo.
  */
@@ -2641,24 +5524,19 @@ void plv8_runtime::touchContext(const char *context_id)
 	{
 		Isolate::Scope			scope(isolate);
 		HandleScope				handle_scope(isolate);
-		if (!ctx_queue.empty() && ctx_queue.size() >= plv8_context_cache_size)
-		{
-			auto &key = std::get<0>(ctx_queue.back());
-			ClearProcCache(this, key.c_str());
-			disposeContext(ctx_queue.back());
-			ctx_map.erase(key);
-			ctx_queue.pop_back();
-		}
+		evictContexts(1);
 		auto	newContext = Context::New(isolate, NULL, GetGlobalObjectTemplate(this));
 		if (plv8_max_eval_size >= 0)
 			newContext->AllowCodeGenerationFromStrings(false);
-		ctx_queue.emplace_front(context_id, Global<Context>(isolate, newContext));
+		ctx_queue.emplace_front(context_id, Global<Context>(isolate, newContext), 0,
+								GetCurrentStatementStartTimestamp());
 		ctx_map[context_id] = ctx_queue.begin();
 		RunStartProc(this);
 	}
 	else
 	{
 		auto it = ctx_map[context_id];
+		std::get<3>(*it) = GetCurrentStatementStartTimestamp();
 		if (it != ctx_queue.begin())
 		{
 			ctx_queue.splice(ctx_queue.begin(), ctx_queue, it);
@@ -2681,13 +5559,349 @@ void plv8_runtime::removeContext(const char *context_id)
 	if (it != ctx_map.end())
 	{
 		ClearProcCache(this, context_id);
+		clearEvalCache(context_id);
 		disposeContext(*it->second);
 		ctx_queue.erase(it->second);
 		ctx_map.erase(it);
 	}
 }
 
-void plv8_runtime::disposeContext (std::tuple<std::string, Global<Context>> &tuple) const
+/*
+ * Dispose of the default and user contexts with the functions compiled in
+ * them.  The isolate, its templates and the code caches are kept, so the
+ * next call only pays for a new context and plv8.start_proc.
+ */
+void plv8_runtime::resetContexts()
+{
+	/*
+	 * The receivers moved to exec_env_head stay until the end of the
+	 * transaction, calls set up already may still use them.
+	 */
+	ClearProcCache(this);
+	clearEvalCache();
+	while (!ctx_queue.empty())
+	{
+		disposeContext(ctx_queue.front());
+		ctx_queue.pop_front();
+	}
+	ctx_map.clear();
+	if (!default_context.IsEmpty())
+	{
+		Isolate::Scope	scope(isolate);
+
+		default_context.Reset();
+		isolate->ContextDisposedNotification();
+	}
+	reset_pending = false;
+}
+
+/*
+ * Evict the least recently used contexts while there are more than
+ * plv8.context_cache_size - reserve of them, or while their last measured
+ * heap size adds up to more than plv8.context_cache_budget.  Unless room is
+ * being made for a new context, the budget never evicts the most recently
+ * used one.
+ */
+void plv8_runtime::evictContexts(size_t reserve)
+{
+	size_t		budget = plv8_context_cache_budget * 1_MB;
+	size_t		quota = plv8_context_heap_quota * 1_MB;
+	size_t		total = 0;
+
+	if (quota > 0)
+	{
+		for (auto it = ctx_queue.begin(); it != ctx_queue.end(); )
+		{
+			auto	cur = it++;
+
+			if (std::get<2>(*cur) > quota)
+			{
+				std::string	key = std::get<0>(*cur);
+
+				ctx_stats[key].evicted++;
+				removeContext(key.c_str());
+			}
+		}
+	}
+
+	for (auto &it: ctx_queue)
+		total += std::get<2>(it);
+
+	while (!ctx_queue.empty())
+	{
+		bool	over_count = ctx_queue.size() + reserve > plv8_context_cache_size;
+		bool	over_budget = budget > 0 && total > budget && ctx_queue.size() + reserve > 1;
+
+		if (!over_count && !over_budget)
+			break;
+
+		auto &key = std::get<0>(ctx_queue.back());
+		total -= std::get<2>(ctx_queue.back());
+		ctx_stats[key].evicted++;
+		ClearProcCache(this, key.c_str());
+		clearEvalCache(key.c_str());
+		disposeContext(ctx_queue.back());
+		ctx_map.erase(key);
+		ctx_queue.pop_back();
+	}
+}
+
+/*
+ * The key of a compiled source in the eval cache: the user context it
+ * belongs to, and what it was compiled for followed by the source.  kind
+ * is 'e' for plv8.compile(), the dialect for DO blocks.
+ */
+static std::string
+EvalKey(char kind, const char *src, size_t len)
+{
+	std::string		key(plv8_user_context ? plv8_user_context : "");
+
+	key.push_back('\0');
+	key.push_back(kind);
+	key.append(src, len);
+	return key;
+}
+
+/*
+ * Look up a compiled source, an empty handle if it is not cached.
+ */
+Local<Function> plv8_runtime::findEval(const std::string &key)
+{
+	auto	it = eval_map.find(key);
+
+	if (it == eval_map.end())
+	{
+		eval_misses++;
+		return Local<Function>();
+	}
+	eval_lru.splice(eval_lru.begin(), eval_lru, it->second.lru);
+	eval_hits++;
+	return it->second.function.Get(isolate);
+}
+
+/*
+ * Keep a compiled source, up to plv8.eval_cache_size of them and
+ * plv8.eval_cache_budget MB of source, releasing the least recently used.
+ */
+void plv8_runtime::cacheEval(std::string &&key, Local<Function> function)
+{
+	if (plv8_eval_cache_size <= 0)
+		return;
+
+	auto	entry = eval_map.emplace(std::move(key), plv8_eval_entry()).first;
+	entry->second.function.Reset(isolate, function);
+	eval_lru.push_front(&entry->first);
+	entry->second.lru = eval_lru.begin();
+	eval_size += entry->first.size();
+
+	size_t	budget = plv8_eval_cache_budget * 1_MB;
+	while (eval_lru.size() > (size_t) plv8_eval_cache_size ||
+		   (budget > 0 && eval_size > budget && eval_lru.size() > 1))
+	{
+		auto	victim = eval_map.find(*eval_lru.back());
+
+		eval_size -= victim->first.size();
+		eval_lru.pop_back();
+		eval_map.erase(victim);
+		eval_evicted++;
+	}
+}
+
+/*
+ * The function taking args with src as its body, compiled in the current
+ * user context.  Sources longer than plv8.max_eval_size are refused like
+ * eval().
+ */
+Local<Function> plv8_runtime::compileEval(const char *src, size_t len)
+{
+	EscapableHandleScope	handle_scope(isolate);
+
+	if (plv8_max_eval_size >= 0 && len > (size_t) plv8_max_eval_size)
+		throw js_error("compile refused, source is longer than plv8.max_eval_size");
+
+	std::string				key = EvalKey('e', src, len);
+	Local<Function>			function = findEval(key);
+
+	if (!function.IsEmpty())
+		return handle_scope.Escape(function);
+
+	Local<Context>			context = localContext();
+	Context::Scope			context_scope(context);
+	TryCatch				try_catch(isolate);
+	Local<String>			argname = String::NewFromUtf8Literal(isolate, "args");
+	ScriptCompiler::Source	source(ToString(src, len));
+
+	if (!ScriptCompiler::CompileFunctionInContext(context, &source, 1, &argname,
+												  0, nullptr).ToLocal(&function))
+		throw js_error(try_catch);
+
+	cacheEval(std::move(key), function);
+	return handle_scope.Escape(function);
+}
+
+/*
+ * Modules imported by other modules are compiled by compileModule() before
+ * the instantiation, so resolving them only has to look them up.
+ */
+static MaybeLocal<Module>
+ResolveModule(Local<Context> context, Local<String> specifier, Local<Module> referrer)
+{
+	Isolate			   *isolate = context->GetIsolate();
+	String::Utf8Value	name(isolate, specifier);
+	auto				it = current_runtime->module_map.find(EvalKey('m', *name, name.length()));
+
+	if (it == current_runtime->module_map.end())
+	{
+		isolate->ThrowException(Exception::Error(String::NewFromUtf8Literal(isolate, "module not found")));
+		return MaybeLocal<Module>();
+	}
+	return it->second.Get(isolate);
+}
+
+/*
+ * The module of plv8_es_modules named name in the current user context, along
+ * with the modules it imports.  Modules are compiled the first time they
+ * are imported, from the code cache of the backend if another runtime
+ * compiled the same source already.
+ */
+Local<Module> plv8_runtime::compileModule(Local<String> name)
+{
+	EscapableHandleScope	handle_scope(isolate);
+
+	if (module_generation != plv8_es_modules_generation)
+	{
+		module_map.clear();
+		module_generation = plv8_es_modules_generation;
+	}
+
+	String::Utf8Value		utf8(isolate, name);
+	std::string				key = EvalKey('m', *utf8, utf8.length());
+	auto					it = module_map.find(key);
+
+	if (it != module_map.end())
+		return handle_scope.Escape(it->second.Get(isolate));
+
+	CString					dbname(name);
+	char				   *src = nullptr;
+
+	PG_TRY();
+	{
+		src = plv8_module_source(dbname);
+	}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
+
+	if (src == nullptr)
+	{
+		StringInfoData	msg;
+
+		initStringInfo(&msg);
+		appendStringInfo(&msg, "module \"%s\" not found", dbname.str());
+		throw js_error(msg.data);
+	}
+
+	TryCatch				try_catch(isolate);
+	std::string				cache_key(1, 'm');
+	cache_key.append(*utf8, utf8.length()).push_back('\0');
+	cache_key.append(src);
+	const std::string	   *cached = FindCompiled(cache_key);
+	// lines are numbered from 2 like function bodies, see js_error::init()
+	v8::ScriptOrigin		origin(name, Integer::New(isolate, 1), Integer::New(isolate, 0),
+								   False(isolate), Local<Integer>(), Local<v8::Value>(),
+								   False(isolate), False(isolate), True(isolate));
+	ScriptCompiler::Source	source(ToString(src), origin,
+								   cached == nullptr ? nullptr :
+								   new ScriptCompiler::CachedData((const uint8_t *) cached->data(),
+																  cached->size()));
+	Local<Module>			module;
+
+	pfree(src);
+	if (!ScriptCompiler::CompileModule(isolate, &source,
+									   cached == nullptr ? ScriptCompiler::kNoCompileOptions :
+														   ScriptCompiler::kConsumeCodeCache).ToLocal(&module))
+		throw js_error(try_catch);
+
+	if (cached == nullptr || source.GetCachedData()->rejected)
+	{
+		std::unique_ptr<ScriptCompiler::CachedData> data(
+			ScriptCompiler::CreateCodeCache(module->GetUnboundModuleScript()));
+		if (data)
+			CacheCompiled(std::move(cache_key), (const char *) data->data, data->length, 0);
+	}
+
+	// before its imports, which may import it back
+	module_map.emplace(std::move(key), Global<Module>(isolate, module));
+	for (int i = 0; i < module->GetModuleRequestsLength(); i++)
+		compileModule(module->GetModuleRequest(i));
+
+	return handle_scope.Escape(module);
+}
+
+/*
+ * The namespace of a module, instantiated and evaluated in the current
+ * context the first time it is imported.
+ */
+Local<v8::Value> plv8_runtime::importModule(Local<String> name)
+{
+	EscapableHandleScope	handle_scope(isolate);
+	Local<Context>			context = isolate->GetCurrentContext();
+	Local<Module>			module = compileModule(name);
+	TryCatch				try_catch(isolate);
+
+	if (module->GetStatus() == Module::kUninstantiated &&
+		!module->InstantiateModule(context, ResolveModule).FromMaybe(false))
+		throw js_error(try_catch);
+
+	// a module importing itself while being evaluated gets its namespace as is
+	if (module->GetStatus() == Module::kInstantiated &&
+		module->Evaluate(context).IsEmpty())
+		throw js_error(try_catch);
+
+	if (module->GetStatus() == Module::kErrored)
+		throw js_error(isolate, module->GetException(), Local<Message>());
+
+	return handle_scope.Escape(module->GetModuleNamespace());
+}
+
+/*
+ * Release the plv8.compile() functions and the modules of a user context,
+ * or all of them.
+ */
+void plv8_runtime::clearEvalCache(const char *context_id)
+{
+	std::string		prefix;
+
+	if (context_id != nullptr)
+	{
+		prefix.assign(context_id);
+		prefix.push_back('\0');
+	}
+
+	for (auto it = eval_map.begin(); it != eval_map.end(); )
+	{
+		if (context_id == nullptr || it->first.compare(0, prefix.size(), prefix) == 0)
+		{
+			eval_size -= it->first.size();
+			eval_lru.erase(it->second.lru);
+			it = eval_map.erase(it);
+		}
+		else
+			++it;
+	}
+
+	for (auto it = module_map.begin(); it != module_map.end(); )
+	{
+		if (context_id == nullptr || it->first.compare(0, prefix.size(), prefix) == 0)
+			it = module_map.erase(it);
+		else
+			++it;
+	}
+}
+
+void plv8_runtime::disposeContext (std::tuple<std::string, Global<Context>, size_t, TimestampTz> &tuple) const
 {
 	Isolate::Scope			scope(isolate);
 	HandleScope				handle_scope(isolate);
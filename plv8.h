@@ -14,6 +14,7 @@
 #include <v8-debug.h>
 #endif  // ENABLE_DEBUGGER_SUPPORT
 #include <v8-version-string.h>
+#include <v8-profiler.h>
 #include <vector>
 #include <list>
 #include <unordered_map>
@@ -22,8 +23,10 @@ extern "C" {
 #include "postgres.h"
 
 #include "access/htup.h"
+#include "datatype/timestamp.h"
 #include "fmgr.h"
 #include "mb/pg_wchar.h"
+#include "utils/resowner.h"
 #include "utils/tuplestore.h"
 #include "windowapi.h"
 }
@@ -77,6 +80,21 @@ public:
 	__attribute__((noreturn)) void rethrow() throw();
 };
 
+/*
+ * SubTranBlock runs a block in an internal subtransaction, rolled back
+ * when exit() is given false.
+ */
+class SubTranBlock
+{
+private:
+	ResourceOwner		m_resowner;
+	MemoryContext		m_mcontext;
+public:
+	SubTranBlock();
+	void enter();
+	void exit(bool success);
+};
+
 typedef enum plv8_external_array_type
 {
 	kExternalByteArray = 1,
@@ -110,6 +128,48 @@ typedef struct plv8_type
 	plv8_external_array_type ext_array;
 } plv8_type;
 
+/*
+ * Accounting of a user context, "" being the default context.  It outlives
+ * the context being evicted.
+ */
+typedef struct plv8_context_stats
+{
+	uint64		calls;
+	double		cpu_time;			/* ms */
+	int64		heap_delta;			/* net heap growth in bytes */
+	uint64		throttled;
+	uint64		failed;
+	uint64		evicted;
+	TimestampTz	window_start;		/* of the current quota interval */
+	double		window_cpu_time;	/* ms in the current quota interval */
+	double		last_cpu_time;		/* ms of the last call */
+	TimestampTz	last_used;			/* start of the last call */
+} plv8_context_stats;
+
+/* upper bounds in ms of the GC pause histogram, the last bucket is unbounded */
+#define PLV8_GC_PAUSE_BUCKETS	8
+
+typedef struct plv8_gc_stats
+{
+	uint64		scavenges;
+	uint64		mark_compacts;
+	uint64		incremental_steps;	/* of incremental marking */
+	double		total_time;			/* ms of all the pauses */
+	double		max_pause;			/* ms */
+	uint64		pauses[PLV8_GC_PAUSE_BUCKETS];
+	double		pause_start;		/* of the GC in progress, in seconds */
+} plv8_gc_stats;
+
+/*
+ * A function compiled by plv8.compile() or plv8_eval(), or a DO block,
+ * looked up by the user context it belongs to and its source.
+ */
+typedef struct plv8_eval_entry
+{
+	v8::Global<v8::Function>				function;
+	std::list<const std::string *>::iterator	lru;	/* position in eval_lru */
+} plv8_eval_entry;
+
 /*
  * For the security reasons, the runtime is separated
  * between users and it's associated with user id.
@@ -125,15 +185,54 @@ typedef struct plv8_runtime
 	v8::Persistent<v8::ObjectTemplate>  plan_template;
 	v8::Persistent<v8::ObjectTemplate>  cursor_template;
 	v8::Persistent<v8::ObjectTemplate>  window_template;
+	v8::Persistent<v8::ObjectTemplate>  hashmap_template;
+	MemoryContext						hashmap_context;	/* parent of plv8.HashMap contexts */
 	v8::Local<v8::Context> localContext() const;
 	bool 						is_dead;
 	bool						interrupted;
+	bool						heap_limit_hit;		/* call terminated at the heap limit */
+	bool						heap_limit_raised;	/* by NearHeapLimitHandler() */
+	size_t						initial_heap_limit;
+	uint64						heap_limit_recovered;
+	uint64						heap_limit_killed;
+	bool						idle_gc;			/* used by the current transaction */
+	TimestampTz					idle_since;			/* end of the last transaction using it, see IdleGC() */
+	size_t						idle_gc_heap;		/* used heap after the last IdleGC() */
+	bool						reset_pending;		/* resetContexts() at the end of the transaction */
+	plv8_gc_stats				gc_stats;
+	v8::CpuProfiler			   *profiler;			/* created on first use */
+	bool						profiling;			/* by plv8_profile_start() */
+	bool						call_profiling;		/* see CallProfile */
 	Oid							user_id;
-	std::list<std::tuple<std::string, v8::Global<v8::Context>>> ctx_queue;
-	std::unordered_map<std::string, std::list<std::tuple<std::string, v8::Global<v8::Context>>>::iterator> ctx_map;
+	/*
+	 * user contexts, most recently used first, with their last measured heap
+	 * size and the start of the last statement using them
+	 */
+	std::list<std::tuple<std::string, v8::Global<v8::Context>, size_t, TimestampTz>> ctx_queue;
+	std::unordered_map<std::string, std::list<std::tuple<std::string, v8::Global<v8::Context>, size_t, TimestampTz>>::iterator> ctx_map;
+	bool						measure_pending;	/* MeasureMemory() in flight */
+	std::unordered_map<std::string, plv8_context_stats> ctx_stats;
+	/* plv8.compile() functions and DO blocks, see EvalKey(), most recently used first */
+	std::unordered_map<std::string, plv8_eval_entry> eval_map;
+	std::list<const std::string *> eval_lru;
+	size_t						eval_size;			/* bytes of source in eval_map */
+	uint64						eval_hits;
+	uint64						eval_misses;
+	uint64						eval_evicted;
+	/* modules of plv8_es_modules by user context and name, see EvalKey() */
+	std::unordered_map<std::string, v8::Global<v8::Module>> module_map;
+	uint64						module_generation;	/* of plv8_es_modules when compiled */
+	v8::Local<v8::Function> compileEval(const char *src, size_t len);
+	v8::Local<v8::Function> findEval(const std::string &key);
+	void cacheEval(std::string &&key, v8::Local<v8::Function> function);
+	void clearEvalCache(const char *context_id = nullptr);
+	v8::Local<v8::Module> compileModule(v8::Local<v8::String> name);
+	v8::Local<v8::Value> importModule(v8::Local<v8::String> name);
 	void touchContext(const char *context_id);
 	void removeContext(const char *context_id);
-	void disposeContext (std::tuple<std::string, v8::Global<v8::Context>> &tuple) const;
+	void resetContexts();
+	void evictContexts(size_t reserve);
+	void disposeContext (std::tuple<std::string, v8::Global<v8::Context>, size_t, TimestampTz> &tuple) const;
 	bool wasKilled() const { return is_dead || (isolate != nullptr && isolate->IsDead()); }
 } plv8_runtime;
 
@@ -308,6 +407,7 @@ extern void SetupPlv8Functions(v8::Handle<v8::ObjectTemplate> plv8);
 extern void SetupPrepFunctions(v8::Handle<v8::ObjectTemplate> templ);
 extern void SetupCursorFunctions(v8::Handle<v8::ObjectTemplate> templ);
 extern void SetupWindowFunctions(v8::Handle<v8::ObjectTemplate> templ);
+extern void SetupHashMapFunctions(v8::Handle<v8::ObjectTemplate> templ);
 
 extern void GetMemoryInfo(v8::Local<v8::Object> obj);
 
@@ -1,39 +1,244 @@
 #include "plv8_allocator.h"
 
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "utils/memutils.h"
+} // extern "C"
+
 #define RECHECK_INCREMENT 1_MB
+// fraction of the hard limit where we start asking for GC
+#define SOFT_LIMIT_RATIO 0.8
 
 size_t operator""_MB( unsigned long long const x ) noexcept { return 1024L * 1024L * x; }
 
-ArrayAllocator::ArrayAllocator(size_t limit) : heap_limit(limit),
-											   heap_size(RECHECK_INCREMENT),
-											   next_size(RECHECK_INCREMENT),
-											   allocated(0) {}
+static inline int size_class(size_t length) {
+	int cls = 0;
+	while ((size_t) 1 << (cls + ARRAY_POOL_MIN_SHIFT) < length)
+		cls++;
+	return cls;
+}
+
+static inline size_t class_size(int cls) {
+	return (size_t) 1 << (cls + ARRAY_POOL_MIN_SHIFT);
+}
+
+static inline size_t page_align(size_t length) {
+#ifdef _MSC_VER
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	size_t page = info.dwPageSize;
+#else
+	static size_t page = sysconf(_SC_PAGESIZE);
+#endif
+	return (length + page - 1) & ~(page - 1);
+}
+
+static void *map_pages(size_t length) {
+#ifdef _MSC_VER
+	return VirtualAlloc(nullptr, length, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void *data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return data == MAP_FAILED ? nullptr : data;
+#endif
+}
+
+static void unmap_pages(void *data, size_t length) {
+#ifdef _MSC_VER
+	VirtualFree(data, 0, MEM_RELEASE);
+#else
+	munmap(data, length);
+#endif
+}
+
+ArrayAllocator::ArrayAllocator(size_t limit) : hard_limit(limit),
+											   soft_limit(limit * SOFT_LIMIT_RATIO),
+											   heap_size(0),
+											   since_check(RECHECK_INCREMENT),
+											   allocated(0),
+											   peak(0),
+											   over_soft_limit(false),
+											   allocations(0),
+											   failed_allocations(0),
+											   soft_limit_hits(0),
+											   pooled_bytes(0),
+											   reserved_bytes(0),
+											   requested_bytes(0),
+											   mapped_bytes(0),
+											   pool_hits(0),
+											   pool_misses(0) {
+#if PG_VERSION_NUM < 110000
+	pool_context = AllocSetContextCreate(TopMemoryContext,
+										 "PLV8 ArrayBuffers",
+										 ALLOCSET_DEFAULT_MINSIZE,
+										 ALLOCSET_DEFAULT_INITSIZE,
+										 ALLOCSET_DEFAULT_MAXSIZE);
+#else
+	pool_context = AllocSetContextCreate(TopMemoryContext,
+										 "PLV8 ArrayBuffers",
+										 ALLOCSET_DEFAULT_SIZES);
+#endif
+	memset(freelist, 0, sizeof(freelist));
+}
+
+ArrayAllocator::~ArrayAllocator() {
+	// the isolate is gone, and all of its buffers with it
+	MemoryContextDelete(pool_context);
+}
 
 bool ArrayAllocator::check(const size_t length) {
-	if (heap_size + allocated + length > next_size) {
-		v8::Isolate* isolate = v8::Isolate::GetCurrent();
+	v8::Isolate* isolate = v8::Isolate::GetCurrent();
+	size_t used = allocated.load(std::memory_order_relaxed);
+
+	// heap statistics are not free, so only refresh them every RECHECK_INCREMENT
+	// or when the cached value says we are over the limit, as it may be stale
+	if (isolate != nullptr &&
+		(since_check + length > RECHECK_INCREMENT || heap_size + used + length > hard_limit)) {
 		v8::HeapStatistics heap_statistics;
 		isolate->GetHeapStatistics(&heap_statistics);
 		heap_size = heap_statistics.used_heap_size();
-		if (heap_size + allocated + length > heap_limit) {
-			// wee need to force GC here,
-			// otherwise the next allocation will fail even if there is a space for it
-			isolate->LowMemoryNotification();
-			isolate->GetHeapStatistics(&heap_statistics);
-			heap_size = heap_statistics.used_heap_size();
-			if (heap_size + allocated + length > heap_limit) {
-				return false;
-			}
+		since_check = 0;
+	}
+
+	size_t total = heap_size + used + length;
+	if (total > hard_limit) {
+		// no forced GC here: V8 collects garbage itself and retries
+		// when the allocator fails (see Heap::AllocateExternalBackingStore),
+		// starting with a cheap scavenge of the young generation
+		failed_allocations++;
+		return false;
+	}
+
+	if (total > soft_limit) {
+		// only ask once per crossing, kModerate starts incremental marking
+		// instead of running a full GC synchronously
+		if (!over_soft_limit && isolate != nullptr) {
+			soft_limit_hits++;
+			isolate->MemoryPressureNotification(v8::MemoryPressureLevel::kModerate);
 		}
-		next_size = heap_size + allocated + length + RECHECK_INCREMENT;
+		over_soft_limit = true;
+	} else {
+		over_soft_limit = false;
 	}
-	return heap_size + allocated + length <= heap_limit;
+
+	since_check += length;
+	return true;
+}
+
+void ArrayAllocator::account(const size_t length) {
+	size_t used = allocated.fetch_add(length, std::memory_order_relaxed) + length;
+	if (used > peak)
+		peak = used;
+	allocations++;
+}
+
+void* ArrayAllocator::PoolAllocate(size_t length, bool zero) {
+	void *data = nullptr;
+
+	if (length > class_size(ARRAY_POOL_CLASSES - 1)) {
+		// fresh pages are already zeroed
+		size_t mapped = page_align(length);
+		data = map_pages(mapped);
+		if (data != nullptr) {
+			std::lock_guard<std::mutex> guard(pool_lock);
+			mapped_bytes += mapped;
+		}
+		return data;
+	}
+
+	int cls = size_class(length);
+	size_t size = class_size(cls);
+	{
+		std::lock_guard<std::mutex> guard(pool_lock);
+		data = freelist[cls];
+		if (data != nullptr) {
+			freelist[cls] = *(void **) data;
+			pooled_bytes -= size;
+			pool_hits++;
+		} else {
+			pool_misses++;
+		}
+	}
+
+	if (data == nullptr) {
+		// palloc must not longjmp through V8
+#if PG_VERSION_NUM >= 90500
+		data = MemoryContextAllocExtended(pool_context, size, MCXT_ALLOC_NO_OOM);
+#else
+		PG_TRY();
+		{
+			data = MemoryContextAlloc(pool_context, size);
+		}
+		PG_CATCH();
+		{
+			FlushErrorState();
+			data = nullptr;
+		}
+		PG_END_TRY();
+#endif
+		if (data == nullptr)
+			return nullptr;
+	}
+
+	if (zero)
+		memset(data, 0, length);
+
+	std::lock_guard<std::mutex> guard(pool_lock);
+	reserved_bytes += size;
+	requested_bytes += length;
+	return data;
+}
+
+void ArrayAllocator::PoolFree(void *data, size_t length) {
+	if (length > class_size(ARRAY_POOL_CLASSES - 1)) {
+		size_t mapped = page_align(length);
+		unmap_pages(data, mapped);
+		std::lock_guard<std::mutex> guard(pool_lock);
+		mapped_bytes -= mapped;
+		return;
+	}
+
+	int cls = size_class(length);
+	size_t size = class_size(cls);
+	std::lock_guard<std::mutex> guard(pool_lock);
+	*(void **) data = freelist[cls];
+	freelist[cls] = data;
+	pooled_bytes += size;
+	reserved_bytes -= size;
+	requested_bytes -= length;
+}
+
+/*
+ * Give cached chunks back to the memory context until at most keep bytes
+ * are left, largest classes first.  Must be called from the backend thread.
+ */
+void ArrayAllocator::TrimPool(size_t keep) {
+	std::lock_guard<std::mutex> guard(pool_lock);
+	for (int cls = ARRAY_POOL_CLASSES - 1; cls >= 0 && pooled_bytes > keep; cls--) {
+		while (freelist[cls] != nullptr && pooled_bytes > keep) {
+			void *data = freelist[cls];
+			freelist[cls] = *(void **) data;
+			pooled_bytes -= class_size(cls);
+			pfree(data);
+		}
+	}
+	if (pooled_bytes == 0 && reserved_bytes == 0)
+		MemoryContextReset(pool_context);
 }
 
 void* ArrayAllocator::Allocate(size_t length) {
 	if (check(length)) {
-		allocated += length;
-		return std::calloc(length, 1);
+		void *data = PoolAllocate(length, true);
+		if (data != nullptr)
+			account(length);
+		return data;
 	} else {
 		return nullptr;
 	}
@@ -41,25 +246,16 @@ void* ArrayAllocator::Allocate(size_t length) {
 
 void* ArrayAllocator::AllocateUninitialized(size_t length) {
 	if (check(length)) {
-		allocated += length;
-		return std::malloc(length);
+		void *data = PoolAllocate(length, false);
+		if (data != nullptr)
+			account(length);
+		return data;
 	} else {
 		return nullptr;
 	}
 }
 
 void ArrayAllocator::Free(void* data, size_t length) {
-	allocated -= length;
-	next_size -= length;
-	std::free(data);
-}
-
-void* ArrayAllocator::Reallocate(void *data, size_t old_length, size_t new_length) {
-	ssize_t delta = static_cast<ssize_t>(new_length) - static_cast<ssize_t>(old_length);
-	if (delta > 0) {
-		if (!check(delta)) {
-			return nullptr;
-		}
-	}
-	return v8::ArrayBuffer::Allocator::Reallocate(data, old_length, new_length);
+	allocated.fetch_sub(length, std::memory_order_relaxed);
+	PoolFree(data, length);
 }
@@ -2,25 +2,84 @@
 #define PLV8_PLV8_ALLOCATOR_H
 
 #include <v8.h>
+#include <atomic>
+#include <mutex>
 #include "plv8.h"
 
 size_t operator""_MB( unsigned long long x ) noexcept;
 
+/* buffers up to 2^20 bytes are pooled in power of two size classes */
+#define ARRAY_POOL_MIN_SHIFT	6
+#define ARRAY_POOL_MAX_SHIFT	20
+#define ARRAY_POOL_CLASSES		(ARRAY_POOL_MAX_SHIFT - ARRAY_POOL_MIN_SHIFT + 1)
+
+/* how much of the pool is kept cached at transaction end */
+#define ARRAY_POOL_KEEP			4_MB
+
+/*
+ * ArrayBuffer allocator enforcing plv8.memory_limit.
+ *
+ * Crossing the soft limit asks V8 for an incremental GC, crossing the hard
+ * limit fails the allocation.
+ *
+ * Small and medium buffers are carved from a "PLV8 ArrayBuffers" memory
+ * context and recycled through per size class freelists, large ones are
+ * mmap'ed.  Allocate() is only called by the backend thread, but Free() can
+ * be called from V8's background sweeper, so it never touches the memory
+ * context: freed chunks go to the freelists under pool_lock and are only
+ * given back to the context by TrimPool().
+ */
 class ArrayAllocator : public v8::ArrayBuffer::Allocator {
 private:
-	size_t heap_limit;
+	size_t hard_limit;
+	size_t soft_limit;
 	size_t heap_size;
-	size_t next_size;
-	size_t allocated;
+	size_t since_check;
+	std::atomic<size_t> allocated;
+	size_t peak;
+	bool over_soft_limit;
+
+	uint64 allocations;
+	uint64 failed_allocations;
+	uint64 soft_limit_hits;
+
+	std::mutex pool_lock;
+	MemoryContext pool_context;
+	void *freelist[ARRAY_POOL_CLASSES];
+	size_t pooled_bytes;		// cached in the freelists
+	size_t reserved_bytes;		// size class bytes of live buffers
+	size_t requested_bytes;		// requested bytes of live pooled buffers
+	size_t mapped_bytes;		// live mmap'ed buffers
+	uint64 pool_hits;
+	uint64 pool_misses;
 
 	bool check(size_t length);
+	void account(size_t length);
+	void *PoolAllocate(size_t length, bool zero);
+	void PoolFree(void *data, size_t length);
 
 public:
 	explicit ArrayAllocator(size_t limit);
+	~ArrayAllocator();
 	void* Allocate(size_t length) final;
 	void* AllocateUninitialized(size_t length) final;
 	void Free(void* data, size_t length) final;
-	void* Reallocate(void *data, size_t old_length, size_t new_length) final;
+
+	void TrimPool(size_t keep);
+
+	size_t GetAllocated() const { return allocated.load(std::memory_order_relaxed); }
+	size_t GetPeak() const { return peak; }
+	size_t GetSoftLimit() const { return soft_limit; }
+	size_t GetHardLimit() const { return hard_limit; }
+	uint64 GetAllocations() const { return allocations; }
+	uint64 GetFailedAllocations() const { return failed_allocations; }
+	uint64 GetSoftLimitHits() const { return soft_limit_hits; }
+	size_t GetPooledBytes() const { return pooled_bytes; }
+	size_t GetReservedBytes() const { return reserved_bytes; }
+	size_t GetRequestedBytes() const { return requested_bytes; }
+	size_t GetMappedBytes() const { return mapped_bytes; }
+	uint64 GetPoolHits() const { return pool_hits; }
+	uint64 GetPoolMisses() const { return pool_misses; }
 };
 
 #endif //PLV8_PLV8_ALLOCATOR_H
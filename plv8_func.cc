@@ -6,7 +6,9 @@
  *-------------------------------------------------------------------------
  */
 #include "plv8.h"
+#include "plv8_hashmap.h"
 #include "plv8_param.h"
+#include "plv8_stats.h"
 #include <string>
 
 extern "C" {
@@ -16,6 +18,7 @@ extern "C" {
 #include "parser/parse_type.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "nodes/memnodes.h"
 } // extern "C"
 
@@ -49,6 +52,18 @@ static void plv8_QuoteNullable(const FunctionCallbackInfo<v8::Value>& args);
 static void plv8_QuoteIdent(const FunctionCallbackInfo<v8::Value>& args);
 static void plv8_MemoryUsage(const FunctionCallbackInfo<v8::Value>& args);
 static void plv8_RunScript(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_Compile(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_Import(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_HashMapNew(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_HashMapSet(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_HashMapGet(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_HashMapHas(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_HashMapDelete(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_HashMapClear(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_HashMapSetMany(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_HashMapGetMany(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_HashMapForEach(const FunctionCallbackInfo<v8::Value>& args);
+static void plv8_HashMapSize(Local<String> property, const PropertyCallbackInfo<v8::Value>& info);
 
 #if PG_VERSION_NUM >= 110000
 static void plv8_Commit(const FunctionCallbackInfo<v8::Value>& args);
@@ -108,30 +123,6 @@ SetCallback(Handle<ObjectTemplate> obj, const char *name,
 					WrapCallback(func)), attr);
 }
 
-class SubTranBlock
-{
-private:
-	ResourceOwner		m_resowner;
-	MemoryContext		m_mcontext;
-public:
-	SubTranBlock();
-	void enter();
-	void exit(bool success);
-};
-
-static text *
-charToText(char *string)
-{
-	int len = strlen(string);
-	text *result = (text *) palloc(len + 1 + VARHDRSZ);
-
-	SET_VARSIZE(result, len + VARHDRSZ);
-	memcpy(VARDATA(result), string, len + 1);
-
-	return result;
-}
-
-
 static Handle<v8::Value>
 SPIResultToValue(int status)
 {
@@ -281,6 +272,9 @@ SetupPlv8Functions(Handle<ObjectTemplate> plv8)
 	SetCallback(plv8, "quote_ident", plv8_QuoteIdent, attrFull);
 	SetCallback(plv8, "memory_usage", plv8_MemoryUsage, attrFull);
 	SetCallback(plv8, "run_script", plv8_RunScript, attrFull);
+	SetCallback(plv8, "compile", plv8_Compile, attrFull);
+	SetCallback(plv8, "import", plv8_Import, attrFull);
+	SetCallback(plv8, "HashMap", plv8_HashMapNew, attrFull);
 
 #if PG_VERSION_NUM >= 110000
 	SetCallback(plv8, "rollback", plv8_Rollback, attrFull);
@@ -334,6 +328,25 @@ SetupWindowFunctions(Handle<ObjectTemplate> templ)
 			Int32::New(isolate, WINDOW_SEEK_TAIL));
 }
 
+void
+SetupHashMapFunctions(Handle<ObjectTemplate> templ)
+{
+	Isolate *isolate = Isolate::GetCurrent();
+	/* We store plv8_hashmap here. */
+	templ->SetInternalFieldCount(1);
+
+	SetCallback(templ, "set", plv8_HashMapSet);
+	SetCallback(templ, "get", plv8_HashMapGet);
+	SetCallback(templ, "has", plv8_HashMapHas);
+	SetCallback(templ, "delete", plv8_HashMapDelete);
+	SetCallback(templ, "clear", plv8_HashMapClear);
+	SetCallback(templ, "setMany", plv8_HashMapSetMany);
+	SetCallback(templ, "getMany", plv8_HashMapGetMany);
+	SetCallback(templ, "forEach", plv8_HashMapForEach);
+	templ->SetAccessor(String::NewFromUtf8Literal(isolate, "size", NewStringType::kInternalized),
+			plv8_HashMapSize);
+}
+
 /*
  * v8 is not exception-safe! We cannot throw C++ exceptions over v8 functions.
  * So, we catch C++ exceptions and convert them to JavaScript ones.
@@ -585,6 +598,7 @@ convertArgsToArray(const FunctionCallbackInfo<v8::Value> &args, int start, int d
 static void
 plv8_Execute(const FunctionCallbackInfo<v8::Value> &args)
 {
+	StatsTimer		spi_stats(PLV8_STATS_SPI);
 	int				status;
 
 	if (args.Length() < 1) {
@@ -703,6 +717,7 @@ plv8_Prepare(const FunctionCallbackInfo<v8::Value> &args)
 static void
 plv8_PlanCursor(const FunctionCallbackInfo<v8::Value> &args)
 {
+	StatsTimer			spi_stats(PLV8_STATS_SPI);
 	Isolate *			isolate = args.GetIsolate();
 	Local<Context>		context = isolate->GetCurrentContext();
 	Handle<v8::Object>	self = args.This();
@@ -811,6 +826,7 @@ plv8_PlanCursor(const FunctionCallbackInfo<v8::Value> &args)
 static void
 plv8_PlanExecute(const FunctionCallbackInfo<v8::Value> &args)
 {
+	StatsTimer			spi_stats(PLV8_STATS_SPI);
 	Handle<v8::Object>	self = args.This();
 	Local<Context>		context = args.GetIsolate()->GetCurrentContext();
 	SPIPlanPtr			plan;
@@ -939,6 +955,7 @@ plv8_PlanFree(const FunctionCallbackInfo<v8::Value> &args)
 static void
 plv8_CursorFetch(const FunctionCallbackInfo<v8::Value> &args)
 {
+	StatsTimer			spi_stats(PLV8_STATS_SPI);
 	Isolate*			isolate = args.GetIsolate();
 	Local<Context>		context = isolate->GetCurrentContext();
 	Handle<v8::Object>	self = args.This();
@@ -1004,6 +1021,7 @@ plv8_CursorFetch(const FunctionCallbackInfo<v8::Value> &args)
 static void
 plv8_CursorMove(const FunctionCallbackInfo<v8::Value>& args)
 {
+	StatsTimer			spi_stats(PLV8_STATS_SPI);
 	Isolate*			isolate = args.GetIsolate();
 	Handle<v8::Object>	self = args.This();
 	CString				cname(self->GetInternalField(0));
@@ -1134,62 +1152,10 @@ plv8_FindFunction(const FunctionCallbackInfo<v8::Value>& args)
 	}
 	CString				signature(args[0]);
 	Local<Function>		func;
-#if PG_VERSION_NUM < 120000
-	FunctionCallInfoData fake_fcinfo;
-#else
-	// Stack-allocate FunctionCallInfoBaseData with
-	// space for 2 arguments:
-	LOCAL_FCINFO(fake_fcinfo, 2);
-#endif
-	FmgrInfo	flinfo;
-	text *arg;
-
-	char perm[16];
-	strcpy(perm, "EXECUTE");
-	arg = charToText(perm);
-	Oid funcoid;
 
 	PG_TRY();
 	{
-		if (strchr(signature, '(') == NULL)
-			funcoid = DatumGetObjectId(
-					DirectFunctionCall1(regprocin, CStringGetDatum(signature.str())));
-		else
-			funcoid = DatumGetObjectId(
-					DirectFunctionCall1(regprocedurein, CStringGetDatum(signature.str())));
-
-#if PG_VERSION_NUM < 120000
-				MemSet(&fake_fcinfo, 0, sizeof(fake_fcinfo));
-				MemSet(&flinfo, 0, sizeof(flinfo));
-				fake_fcinfo.flinfo = &flinfo;
-				flinfo.fn_oid = InvalidOid;
-				flinfo.fn_mcxt = CurrentMemoryContext;
-				fake_fcinfo.nargs = 2;
-				fake_fcinfo.arg[0] = ObjectIdGetDatum(funcoid);
-				fake_fcinfo.arg[1] = CStringGetDatum(arg);
-				Datum ret = has_function_privilege_id(&fake_fcinfo);
-#else
-				MemSet(&flinfo, 0, sizeof(flinfo));
-				fake_fcinfo->flinfo = &flinfo;
-				flinfo.fn_oid = InvalidOid;
-				flinfo.fn_mcxt = CurrentMemoryContext;
-				fake_fcinfo->nargs = 2;
-				fake_fcinfo->args[0].value = ObjectIdGetDatum(funcoid);
-				fake_fcinfo->args[1].value = CStringGetDatum(arg);
-				Datum ret = has_function_privilege_id(fake_fcinfo);
-#endif
-
-		if (ret == 0) {
-			elog(WARNING, "failed to find or no permission for js function %s", signature.str());
-		} else {
-			if (DatumGetBool(ret)) {
-				func = find_js_function(funcoid);
-				if (func.IsEmpty())
-					elog(ERROR, "javascript function is not found for \"%s\"", signature.str());
-			} else {
-				elog(WARNING, "no permission to execute js function %s", signature.str());
-			}
-		}
+		func = find_js_function_by_name(signature.str());
 	}
 	PG_CATCH();
 	{
@@ -1746,6 +1712,617 @@ plv8_RunScript(const FunctionCallbackInfo<v8::Value>& args)
 	args.GetReturnValue().Set(result);
 }
 
+/*
+ * plv8.compile(src) returns a function taking args with src as its body.
+ * It is cached by the runtime, compiling the same source again is a lookup.
+ */
+static void
+plv8_Compile(const FunctionCallbackInfo<v8::Value>& args)
+{
+	Isolate *		isolate = args.GetIsolate();
+	if (args.Length() < 1) {
+		args.GetReturnValue().Set(Undefined(isolate));
+		return;
+	}
+	HandleScope			handle_scope(isolate);
+	CString				src(args[0]);
+
+	if (src.str() == NULL)
+		throw js_error("source must be a string");
+
+	args.GetReturnValue().Set(current_runtime->compileEval(src, strlen(src)));
+}
+
+/*
+ * plv8.import(name) returns the namespace of a module in plv8_es_modules.
+ */
+static void
+plv8_Import(const FunctionCallbackInfo<v8::Value>& args)
+{
+	Isolate *		isolate = args.GetIsolate();
+	HandleScope		handle_scope(isolate);
+
+	if (args.Length() < 1 || !args[0]->IsString())
+		throw js_error("module name must be a string");
+
+	args.GetReturnValue().Set(current_runtime->importModule(args[0].As<String>()));
+}
+
+/*
+ * Short-cut routine for HashMap API
+ */
+static inline plv8_hashmap *
+plv8_HashMapOf(Handle<v8::Object> self)
+{
+	if (self->InternalFieldCount() < 1 || !self->GetInternalField(0)->IsExternal())
+		return NULL;
+
+	/* plv8_hashmap is embedded in the internal field.  See plv8_HashMapNew() */
+	return static_cast<plv8_hashmap *>(
+			Handle<External>::Cast(self->GetInternalField(0))->Value());
+}
+
+static inline plv8_hashmap *
+plv8_MyHashMap(const FunctionCallbackInfo<v8::Value>& args)
+{
+	plv8_hashmap *map = plv8_HashMapOf(args.This());
+
+	if (map == NULL)
+		throw js_error("HashMap method called with wrong object");
+	return map;
+}
+
+static Datum
+plv8_HashMapKey(plv8_hashmap *map, Handle<v8::Value> value)
+{
+	bool		isnull;
+	Datum		key;
+
+	if (value->IsUndefined() || value->IsNull())
+		throw js_error("HashMap key cannot be null");
+	key = ToDatum(value, &isnull, &map->key_type);
+	if (isnull)
+		throw js_error("HashMap key cannot be null");
+	return key;
+}
+
+/*
+ * Batches for setMany()/getMany() can be plain arrays, or typed arrays
+ * whose element type matches the key/value type.  The latter are read
+ * directly from the backing store without creating JS values.
+ */
+static uint32
+plv8_HashMapBatchLength(Handle<v8::Value> batch)
+{
+	if (batch->IsArray())
+		return Handle<Array>::Cast(batch)->Length();
+	if (batch->IsTypedArray())
+		return Handle<TypedArray>::Cast(batch)->Length();
+	throw js_error("HashMap batch must be an Array or a TypedArray");
+}
+
+static const char *
+plv8_HashMapBatchData(Handle<v8::Value> batch, Oid typid)
+{
+	bool		match;
+
+	if (!batch->IsTypedArray())
+		return NULL;
+
+	switch (typid)
+	{
+	case INT2OID:
+		match = batch->IsInt16Array();
+		break;
+	case INT4OID:
+		match = batch->IsInt32Array();
+		break;
+	case INT8OID:
+		match = batch->IsBigInt64Array();
+		break;
+	case FLOAT4OID:
+		match = batch->IsFloat32Array();
+		break;
+	case FLOAT8OID:
+		match = batch->IsFloat64Array();
+		break;
+	default:
+		match = false;
+	}
+	if (!match)
+		return NULL;
+
+	Handle<TypedArray> array = Handle<TypedArray>::Cast(batch);
+	return (const char *) array->Buffer()->GetContents().Data() + array->ByteOffset();
+}
+
+static Datum
+plv8_HashMapBatchDatum(const char *data, uint32 i, Oid typid)
+{
+	switch (typid)
+	{
+	case INT2OID:
+		return Int16GetDatum(((const int16 *) data)[i]);
+	case INT4OID:
+		return Int32GetDatum(((const int32 *) data)[i]);
+	case INT8OID:
+		return Int64GetDatum(((const int64 *) data)[i]);
+	case FLOAT4OID:
+		return Float4GetDatum(((const float4 *) data)[i]);
+	default:
+		return Float8GetDatum(((const float8 *) data)[i]);
+	}
+}
+
+/*
+ * Batch operations convert values in a short-lived memory context that is
+ * reset every few rows, so a 10M row batch doesn't pile up in the SPI
+ * procedure context.
+ */
+class HashMapBatchContext
+{
+private:
+	MemoryContext		m_oldcontext;
+	MemoryContext		m_tmpcontext;
+	uint32				m_rows;
+
+public:
+	HashMapBatchContext()
+	{
+		PG_TRY();
+		{
+#if PG_VERSION_NUM < 110000
+			m_tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+											 "PLV8 HashMap batch",
+											 ALLOCSET_SMALL_MINSIZE,
+											 ALLOCSET_SMALL_INITSIZE,
+											 ALLOCSET_SMALL_MAXSIZE);
+#else
+			m_tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+											 "PLV8 HashMap batch",
+											 ALLOCSET_SMALL_SIZES);
+#endif
+		}
+		PG_CATCH();
+		{
+			throw pg_error();
+		}
+		PG_END_TRY();
+		m_oldcontext = MemoryContextSwitchTo(m_tmpcontext);
+		m_rows = 0;
+	}
+	void next()
+	{
+		if (++m_rows % 1024 == 0)
+			MemoryContextReset(m_tmpcontext);
+	}
+	~HashMapBatchContext()
+	{
+		MemoryContextSwitchTo(m_oldcontext);
+		MemoryContextDelete(m_tmpcontext);
+	}
+};
+
+static void
+HashMapWeakCallback(const WeakCallbackInfo<plv8_hashmap> &data)
+{
+	plv8_hashmap_free(data.GetParameter());
+}
+
+/*
+ * plv8.HashMap(keytype, valuetype)
+ */
+static void
+plv8_HashMapNew(const FunctionCallbackInfo<v8::Value>& args)
+{
+	Isolate *		isolate = args.GetIsolate();
+	Oid				key_typid;
+	Oid				value_typid;
+	int32			typmod;
+	plv8_hashmap   *map;
+
+	if (args.Length() < 2)
+		throw js_error("usage: plv8.HashMap(keytype, valuetype)");
+
+	CString			keytypestr(args[0]);
+	CString			valuetypestr(args[1]);
+
+	PG_TRY();
+	{
+#if PG_VERSION_NUM >= 90400
+		parseTypeString(keytypestr, &key_typid, &typmod, false);
+		parseTypeString(valuetypestr, &value_typid, &typmod, false);
+#else
+		parseTypeString(keytypestr, &key_typid, &typmod);
+		parseTypeString(valuetypestr, &value_typid, &typmod);
+#endif
+
+		if (current_runtime->hashmap_context == NULL)
+#if PG_VERSION_NUM < 110000
+			current_runtime->hashmap_context = AllocSetContextCreate(TopMemoryContext,
+											"PLV8 HashMaps",
+											ALLOCSET_SMALL_MINSIZE,
+											ALLOCSET_SMALL_INITSIZE,
+											ALLOCSET_SMALL_MAXSIZE);
+#else
+			current_runtime->hashmap_context = AllocSetContextCreate(TopMemoryContext,
+											"PLV8 HashMaps",
+											ALLOCSET_SMALL_SIZES);
+#endif
+		map = plv8_hashmap_create(key_typid, value_typid,
+								  current_runtime->hashmap_context);
+	}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
+
+	Local<ObjectTemplate> templ = Local<ObjectTemplate>::New(isolate, current_runtime->hashmap_template);
+
+	Local<v8::Object> result = templ->NewInstance(isolate->GetCurrentContext()).ToLocalChecked();
+	result->SetInternalField(0, External::New(isolate, map));
+
+	/* The map is freed together with its JS object. */
+	map->handle.Reset(isolate, result);
+	map->handle.SetWeak(map, HashMapWeakCallback, WeakCallbackType::kParameter);
+
+	args.GetReturnValue().Set(result);
+}
+
+/*
+ * hashmap.set(key, value)
+ */
+static void
+plv8_HashMapSet(const FunctionCallbackInfo<v8::Value>& args)
+{
+	plv8_hashmap   *map = plv8_MyHashMap(args);
+	bool			isnull;
+
+	if (args.Length() < 2)
+		throw js_error("usage: hashmap.set(key, value)");
+
+	Datum			key = plv8_HashMapKey(map, args[0]);
+	Datum			value = ToDatum(args[1], &isnull, &map->value_type);
+
+	PG_TRY();
+	{
+		plv8_hashmap_put(map, key, value, isnull);
+	}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
+
+	args.GetReturnValue().Set(args.This());
+}
+
+/*
+ * hashmap.get(key)
+ */
+static void
+plv8_HashMapGet(const FunctionCallbackInfo<v8::Value>& args)
+{
+	Isolate *		isolate = args.GetIsolate();
+	plv8_hashmap   *map = plv8_MyHashMap(args);
+	Datum			value;
+	bool			isnull;
+	bool			found;
+
+	if (args.Length() < 1) {
+		args.GetReturnValue().Set(Undefined(isolate));
+		return;
+	}
+
+	Datum			key = plv8_HashMapKey(map, args[0]);
+
+	PG_TRY();
+	{
+		found = plv8_hashmap_get(map, key, &value, &isnull);
+	}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
+
+	if (!found) {
+		args.GetReturnValue().Set(Undefined(isolate));
+		return;
+	}
+	args.GetReturnValue().Set(ToValue(value, isnull, &map->value_type));
+}
+
+/*
+ * hashmap.has(key)
+ */
+static void
+plv8_HashMapHas(const FunctionCallbackInfo<v8::Value>& args)
+{
+	Isolate *		isolate = args.GetIsolate();
+	plv8_hashmap   *map = plv8_MyHashMap(args);
+	Datum			value;
+	bool			isnull;
+	bool			found;
+
+	if (args.Length() < 1) {
+		args.GetReturnValue().Set(Boolean::New(isolate, false));
+		return;
+	}
+
+	Datum			key = plv8_HashMapKey(map, args[0]);
+
+	PG_TRY();
+	{
+		found = plv8_hashmap_get(map, key, &value, &isnull);
+	}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
+
+	args.GetReturnValue().Set(Boolean::New(isolate, found));
+}
+
+/*
+ * hashmap.delete(key)
+ */
+static void
+plv8_HashMapDelete(const FunctionCallbackInfo<v8::Value>& args)
+{
+	Isolate *		isolate = args.GetIsolate();
+	plv8_hashmap   *map = plv8_MyHashMap(args);
+	bool			found;
+
+	if (map->scans > 0)
+		throw js_error("cannot delete from HashMap inside forEach()");
+	if (args.Length() < 1) {
+		args.GetReturnValue().Set(Boolean::New(isolate, false));
+		return;
+	}
+
+	Datum			key = plv8_HashMapKey(map, args[0]);
+
+	PG_TRY();
+	{
+		found = plv8_hashmap_delete(map, key);
+	}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
+
+	args.GetReturnValue().Set(Boolean::New(isolate, found));
+}
+
+/*
+ * hashmap.clear()
+ */
+static void
+plv8_HashMapClear(const FunctionCallbackInfo<v8::Value>& args)
+{
+	plv8_hashmap   *map = plv8_MyHashMap(args);
+
+	if (map->scans > 0)
+		throw js_error("cannot clear HashMap inside forEach()");
+
+	PG_TRY();
+	{
+		plv8_hashmap_clear(map);
+	}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
+
+	args.GetReturnValue().Set(Undefined(args.GetIsolate()));
+}
+
+/*
+ * hashmap.setMany(keys, values)
+ */
+static void
+plv8_HashMapSetMany(const FunctionCallbackInfo<v8::Value>& args)
+{
+	Isolate *		isolate = args.GetIsolate();
+	Local<Context>	context = isolate->GetCurrentContext();
+	plv8_hashmap   *map = plv8_MyHashMap(args);
+
+	if (args.Length() < 2)
+		throw js_error("usage: hashmap.setMany(keys, values)");
+
+	uint32			nkeys = plv8_HashMapBatchLength(args[0]);
+	uint32			nvalues = plv8_HashMapBatchLength(args[1]);
+
+	if (nkeys != nvalues)
+		throw js_error("HashMap keys and values must have the same length");
+
+	Handle<Object>	keys = Handle<Object>::Cast(args[0]);
+	Handle<Object>	values = Handle<Object>::Cast(args[1]);
+	const char	   *keydata = plv8_HashMapBatchData(args[0], map->key_typid);
+	const char	   *valuedata = plv8_HashMapBatchData(args[1], map->value_typid);
+	HashMapBatchContext	batch;
+
+	for (uint32 i = 0; i < nkeys; i++)
+	{
+		Datum		key;
+		Datum		value;
+		bool		isnull = false;
+
+		if (keydata)
+			key = plv8_HashMapBatchDatum(keydata, i, map->key_typid);
+		else
+			key = plv8_HashMapKey(map, keys->Get(context, i).ToLocalChecked());
+		if (valuedata)
+			value = plv8_HashMapBatchDatum(valuedata, i, map->value_typid);
+		else
+			value = ToDatum(values->Get(context, i).ToLocalChecked(), &isnull, &map->value_type);
+
+		PG_TRY();
+		{
+			plv8_hashmap_put(map, key, value, isnull);
+		}
+		PG_CATCH();
+		{
+			throw pg_error();
+		}
+		PG_END_TRY();
+
+		batch.next();
+	}
+
+	args.GetReturnValue().Set(args.This());
+}
+
+/*
+ * hashmap.getMany(keys)
+ * Returns an array with the value for each key, undefined if not found.
+ */
+static void
+plv8_HashMapGetMany(const FunctionCallbackInfo<v8::Value>& args)
+{
+	Isolate *		isolate = args.GetIsolate();
+	Local<Context>	context = isolate->GetCurrentContext();
+	plv8_hashmap   *map = plv8_MyHashMap(args);
+
+	if (args.Length() < 1)
+		throw js_error("usage: hashmap.getMany(keys)");
+
+	uint32			nkeys = plv8_HashMapBatchLength(args[0]);
+	Handle<Object>	keys = Handle<Object>::Cast(args[0]);
+	const char	   *keydata = plv8_HashMapBatchData(args[0], map->key_typid);
+	Local<Array>	result = Array::New(isolate, nkeys);
+	HashMapBatchContext	batch;
+
+	for (uint32 i = 0; i < nkeys; i++)
+	{
+		Datum		key;
+		Datum		value;
+		bool		isnull;
+		bool		found;
+
+		if (keydata)
+			key = plv8_HashMapBatchDatum(keydata, i, map->key_typid);
+		else
+			key = plv8_HashMapKey(map, keys->Get(context, i).ToLocalChecked());
+
+		PG_TRY();
+		{
+			found = plv8_hashmap_get(map, key, &value, &isnull);
+		}
+		PG_CATCH();
+		{
+			throw pg_error();
+		}
+		PG_END_TRY();
+
+		if (found)
+			result->Set(context, i, ToValue(value, isnull, &map->value_type)).Check();
+		else
+			result->Set(context, i, Undefined(isolate)).Check();
+
+		batch.next();
+	}
+
+	args.GetReturnValue().Set(result);
+}
+
+/*
+ * A forEach() scan of a HashMap, ended however the loop is left, so that
+ * a conversion error or an exception of the callback does not leave the
+ * map locked against delete() and clear().
+ */
+class HashMapScan
+{
+private:
+	plv8_hashmap	   *m_map;
+	HASH_SEQ_STATUS		m_status;
+	bool				m_done;
+
+public:
+	explicit HashMapScan(plv8_hashmap *map) : m_map(map), m_done(false)
+	{
+		hash_seq_init(&m_status, map->htab);
+		map->scans++;
+	}
+	~HashMapScan()
+	{
+		if (!m_done)
+			hash_seq_term(&m_status);
+		m_map->scans--;
+	}
+	plv8_hashmap_entry *next()
+	{
+		plv8_hashmap_entry *entry = (plv8_hashmap_entry *) hash_seq_search(&m_status);
+
+		// the scan is terminated by hash_seq_search() at the end
+		if (entry == NULL)
+			m_done = true;
+		return entry;
+	}
+
+private:
+	HashMapScan(const HashMapScan&);
+	HashMapScan& operator = (const HashMapScan&);
+};
+
+/*
+ * hashmap.forEach(function(value, key) { ... })
+ * Keys can't be deleted while iterating.
+ */
+static void
+plv8_HashMapForEach(const FunctionCallbackInfo<v8::Value>& args)
+{
+	Isolate *			isolate = args.GetIsolate();
+	Local<Context>		context = isolate->GetCurrentContext();
+	plv8_hashmap	   *map = plv8_MyHashMap(args);
+	plv8_hashmap_entry *entry;
+
+	if (args.Length() < 1 || !args[0]->IsFunction())
+		throw js_error("usage: hashmap.forEach(callback)");
+
+	Handle<Function>	func = Handle<Function>::Cast(args[0]);
+	TryCatch			try_catch(isolate);
+	HashMapScan			scan(map);
+
+	while ((entry = scan.next()) != NULL)
+	{
+		HandleScope			handle_scope(isolate);
+		Handle<v8::Value>	argv[2];
+
+		argv[0] = ToValue(entry->value, entry->isnull, &map->value_type);
+		argv[1] = ToValue(entry->key.value, false, &map->key_type);
+
+		if (func->Call(context, Undefined(isolate), 2, argv).IsEmpty())
+			throw js_error(try_catch);
+	}
+
+	args.GetReturnValue().Set(Undefined(isolate));
+}
+
+/*
+ * hashmap.size
+ */
+static void
+plv8_HashMapSize(Local<String> property, const PropertyCallbackInfo<v8::Value>& info)
+{
+	Isolate			   *isolate = info.GetIsolate();
+	plv8_hashmap	   *map = plv8_HashMapOf(info.This());
+
+	// accessors are not wrapped by plv8_FunctionInvoker, no C++ exceptions
+	if (map == NULL)
+	{
+		isolate->ThrowException(Exception::TypeError(
+				String::NewFromUtf8Literal(isolate, "HashMap size read from wrong object")));
+		return;
+	}
+	info.GetReturnValue().Set(Number::New(isolate, (double) plv8_hashmap_count(map)));
+}
+
 #if PG_VERSION_NUM >= 110000
 
 static void
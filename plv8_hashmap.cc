@@ -0,0 +1,233 @@
+/*-------------------------------------------------------------------------
+ *
+ * plv8_hashmap.cc : off-heap hash map keyed by Datums.
+ *
+ * Copyright (c) 2009-2012, the PLV8JS Development Group.
+ *-------------------------------------------------------------------------
+ */
+#include "plv8_hashmap.h"
+
+#include <new>
+
+extern "C" {
+#include "catalog/pg_collation.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/typcache.h"
+} // extern "C"
+
+static uint32 plv8_hashmap_hash(const void *key, Size keysize);
+static int plv8_hashmap_match(const void *key1, const void *key2, Size keysize);
+static void plv8_hashmap_init_htab(plv8_hashmap *map);
+
+/*
+ * Create an empty map for the given key and value types.  The key type must
+ * have a default hash opclass.  Everything the map owns lives in a memory
+ * context under parent, so it can be dropped at once.
+ */
+plv8_hashmap *
+plv8_hashmap_create(Oid key_typid, Oid value_typid, MemoryContext parent)
+{
+	MemoryContext	mcxt;
+	TypeCacheEntry *typentry;
+	plv8_hashmap   *map;
+
+	typentry = lookup_type_cache(key_typid,
+								 TYPECACHE_HASH_PROC_FINFO | TYPECACHE_EQ_OPR_FINFO);
+	if (!OidIsValid(typentry->hash_proc) || !OidIsValid(typentry->eq_opr))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_FUNCTION),
+				 errmsg("could not identify a hash function for type %s",
+						format_type_be(key_typid))));
+
+#if PG_VERSION_NUM < 110000
+	mcxt = AllocSetContextCreate(parent,
+								 "PLV8 HashMap",
+								 ALLOCSET_DEFAULT_MINSIZE,
+								 ALLOCSET_DEFAULT_INITSIZE,
+								 ALLOCSET_DEFAULT_MAXSIZE);
+#else
+	mcxt = AllocSetContextCreate(parent,
+								 "PLV8 HashMap",
+								 ALLOCSET_DEFAULT_SIZES);
+#endif
+
+	map = (plv8_hashmap *) MemoryContextAllocZero(mcxt, sizeof(plv8_hashmap));
+	new(&map->handle) v8::Global<v8::Object>();
+	map->mcxt = mcxt;
+
+	map->key_typid = key_typid;
+	get_typlenbyval(key_typid, &map->key_len, &map->key_byval);
+	map->key_collation = OidIsValid(typentry->typcollation) ?
+		DEFAULT_COLLATION_OID : InvalidOid;
+	/* both live in CacheMemoryContext and are never freed */
+	map->hash_finfo = &typentry->hash_proc_finfo;
+	map->eq_finfo = &typentry->eq_opr_finfo;
+	plv8_fill_type(&map->key_type, key_typid, mcxt);
+
+	map->value_typid = value_typid;
+	get_typlenbyval(value_typid, &map->value_len, &map->value_byval);
+	plv8_fill_type(&map->value_type, value_typid, mcxt);
+
+	plv8_hashmap_init_htab(map);
+
+	return map;
+}
+
+void
+plv8_hashmap_free(plv8_hashmap *map)
+{
+	map->handle.Reset();
+	/* the map struct itself lives in mcxt */
+	MemoryContextDelete(map->mcxt);
+}
+
+void
+plv8_hashmap_put(plv8_hashmap *map, Datum key, Datum value, bool isnull)
+{
+	plv8_hashmap_key	hkey;
+	plv8_hashmap_entry *entry;
+	Datum				stored_value;
+	MemoryContext		oldcontext;
+
+	hkey.value = key;
+	hkey.map = map;
+
+	/*
+	 * Copy before touching the table, so that a failed copy leaves it as it
+	 * was.  New entries are entered with the copy of the key, never with the
+	 * caller's datum.
+	 */
+	oldcontext = MemoryContextSwitchTo(map->mcxt);
+	stored_value = isnull ? (Datum) 0 :
+		datumCopy(value, map->value_byval, map->value_len);
+
+	entry = (plv8_hashmap_entry *) hash_search(map->htab, &hkey, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		hkey.value = datumCopy(key, map->key_byval, map->key_len);
+		entry = (plv8_hashmap_entry *) hash_search(map->htab, &hkey, HASH_ENTER, NULL);
+	}
+	else if (!entry->isnull && !map->value_byval)
+		pfree(DatumGetPointer(entry->value));
+
+	entry->isnull = isnull;
+	entry->value = stored_value;
+	MemoryContextSwitchTo(oldcontext);
+}
+
+bool
+plv8_hashmap_get(plv8_hashmap *map, Datum key, Datum *value, bool *isnull)
+{
+	plv8_hashmap_key	hkey;
+	plv8_hashmap_entry *entry;
+
+	hkey.value = key;
+	hkey.map = map;
+
+	entry = (plv8_hashmap_entry *) hash_search(map->htab, &hkey, HASH_FIND, NULL);
+	if (entry == NULL)
+		return false;
+
+	*value = entry->value;
+	*isnull = entry->isnull;
+	return true;
+}
+
+bool
+plv8_hashmap_delete(plv8_hashmap *map, Datum key)
+{
+	plv8_hashmap_key	hkey;
+	plv8_hashmap_entry *entry;
+
+	hkey.value = key;
+	hkey.map = map;
+
+	entry = (plv8_hashmap_entry *) hash_search(map->htab, &hkey, HASH_FIND, NULL);
+	if (entry == NULL)
+		return false;
+
+	/*
+	 * Free the copies only after the entry is unlinked, as the match
+	 * function still needs the stored key while removing it.
+	 */
+	Datum	stored_key = entry->key.value;
+	Datum	stored_value = entry->value;
+	bool	value_isnull = entry->isnull;
+
+	if (hash_search(map->htab, &hkey, HASH_REMOVE, NULL) == NULL)
+		elog(ERROR, "plv8 hashmap corrupted");
+
+	if (!map->key_byval)
+		pfree(DatumGetPointer(stored_key));
+	if (!value_isnull && !map->value_byval)
+		pfree(DatumGetPointer(stored_value));
+	return true;
+}
+
+void
+plv8_hashmap_clear(plv8_hashmap *map)
+{
+	HASH_SEQ_STATUS		status;
+	plv8_hashmap_entry *entry;
+
+	hash_seq_init(&status, map->htab);
+	while ((entry = (plv8_hashmap_entry *) hash_seq_search(&status)) != NULL)
+	{
+		if (!map->key_byval)
+			pfree(DatumGetPointer(entry->key.value));
+		if (!entry->isnull && !map->value_byval)
+			pfree(DatumGetPointer(entry->value));
+	}
+
+	/* dropping the table is cheaper than removing entries one by one */
+	hash_destroy(map->htab);
+	plv8_hashmap_init_htab(map);
+}
+
+long
+plv8_hashmap_count(plv8_hashmap *map)
+{
+	return hash_get_num_entries(map->htab);
+}
+
+static void
+plv8_hashmap_init_htab(plv8_hashmap *map)
+{
+	HASHCTL		hash_ctl = { 0 };
+
+	hash_ctl.keysize = sizeof(plv8_hashmap_key);
+	hash_ctl.entrysize = sizeof(plv8_hashmap_entry);
+	hash_ctl.hash = plv8_hashmap_hash;
+	hash_ctl.match = plv8_hashmap_match;
+	hash_ctl.hcxt = map->mcxt;
+	map->htab = hash_create("PLV8 HashMap entries", 256, &hash_ctl,
+							HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+}
+
+static uint32
+plv8_hashmap_hash(const void *key, Size keysize)
+{
+	const plv8_hashmap_key *hkey = (const plv8_hashmap_key *) key;
+	plv8_hashmap		   *map = hkey->map;
+
+	return DatumGetUInt32(FunctionCall1Coll(map->hash_finfo,
+											map->key_collation,
+											hkey->value));
+}
+
+static int
+plv8_hashmap_match(const void *key1, const void *key2, Size keysize)
+{
+	const plv8_hashmap_key *k1 = (const plv8_hashmap_key *) key1;
+	const plv8_hashmap_key *k2 = (const plv8_hashmap_key *) key2;
+	plv8_hashmap		   *map = k1->map;
+
+	if (DatumGetBool(FunctionCall2Coll(map->eq_finfo,
+									   map->key_collation,
+									   k1->value, k2->value)))
+		return 0;
+	return 1;
+}
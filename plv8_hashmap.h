@@ -0,0 +1,63 @@
+#ifndef _PLV8_HASHMAP_H_
+#define _PLV8_HASHMAP_H_
+
+#include "plv8.h"
+
+extern "C" {
+#include "utils/hsearch.h"
+} // extern "C"
+
+/*
+ * An off-heap hash map keyed by Datums, exposed to JS as plv8.HashMap.
+ * Keys and values are stored in the map's own memory context, hashed and
+ * compared with the key type's default hash opclass, so that large
+ * aggregations don't grow the V8 heap.
+ */
+typedef struct plv8_hashmap
+{
+	MemoryContext			mcxt;
+	HTAB				   *htab;
+	v8::Global<v8::Object>	handle;		/* weak, frees the map when collected */
+
+	Oid						key_typid;
+	int16					key_len;
+	bool					key_byval;
+	Oid						key_collation;
+	FmgrInfo			   *hash_finfo;
+	FmgrInfo			   *eq_finfo;
+	plv8_type				key_type;
+
+	Oid						value_typid;
+	int16					value_len;
+	bool					value_byval;
+	plv8_type				value_type;
+
+	int						scans;		/* number of open forEach() scans */
+} plv8_hashmap;
+
+typedef struct plv8_hashmap_key
+{
+	Datum					value;
+	plv8_hashmap		   *map;		/* needed by the hash/match functions */
+} plv8_hashmap_key;
+
+typedef struct plv8_hashmap_entry
+{
+	plv8_hashmap_key		key;
+	Datum					value;
+	bool					isnull;
+} plv8_hashmap_entry;
+
+// plv8_hashmap.cc
+extern plv8_hashmap *plv8_hashmap_create(Oid key_typid, Oid value_typid,
+										 MemoryContext parent);
+extern void plv8_hashmap_free(plv8_hashmap *map);
+extern void plv8_hashmap_put(plv8_hashmap *map, Datum key,
+							 Datum value, bool isnull);
+extern bool plv8_hashmap_get(plv8_hashmap *map, Datum key,
+							 Datum *value, bool *isnull);
+extern bool plv8_hashmap_delete(plv8_hashmap *map, Datum key);
+extern void plv8_hashmap_clear(plv8_hashmap *map);
+extern long plv8_hashmap_count(plv8_hashmap *map);
+
+#endif	// _PLV8_HASHMAP_H_
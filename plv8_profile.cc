@@ -0,0 +1,325 @@
+/*-------------------------------------------------------------------------
+ *
+ * plv8_profile.cc : CPU profiles of plv8 code in the .cpuprofile format.
+ *
+ * Copyright (c) 2009-2012, the PLV8JS Development Group.
+ *-------------------------------------------------------------------------
+ */
+#include "plv8_profile.h"
+
+extern "C" {
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/json.h"
+#include "utils/timestamp.h"
+} // extern "C"
+
+#include <sys/stat.h>
+#include <algorithm>
+
+using namespace v8;
+
+int		plv8_profile_min_duration = 0;
+int		plv8_profile_interval = 1000;
+int		plv8_profile_max_files = 100;
+
+#define CALL_PROFILE_TITLE	"plv8_call"
+
+/*
+ * Start a profile of the runtime's isolate, sampling every interval
+ * microseconds.  The profiler is created on first use and lives as long as
+ * the isolate.
+ */
+void
+StartProfiling(plv8_runtime *runtime, const char *title, int interval)
+{
+	Isolate	   *isolate = runtime->isolate;
+
+	if (runtime->profiler == nullptr)
+		runtime->profiler = CpuProfiler::New(isolate);
+	runtime->profiler->StartProfiling(String::NewFromUtf8(isolate, title).ToLocalChecked(),
+									  CpuProfilingOptions(kLeafNodeLineNumbers,
+														  CpuProfilingOptions::kNoSampleLimit,
+														  interval));
+}
+
+/*
+ * Stop a profile started by StartProfiling(), to be deleted by the caller.
+ */
+CpuProfile *
+StopProfiling(plv8_runtime *runtime, const char *title)
+{
+	Isolate	   *isolate = runtime->isolate;
+
+	return runtime->profiler->StopProfiling(String::NewFromUtf8(isolate, title).ToLocalChecked());
+}
+
+static void
+append_profile_node(StringInfo buf, const CpuProfileNode *node, plv8_script_map &functions)
+{
+	auto		function = functions.find(node->GetScriptId());
+	bool		is_plv8 = function != functions.end();
+	const char *name = node->GetFunctionNameStr();
+	int			line = node->GetLineNumber();
+	int			column = node->GetColumnNumber();
+	unsigned	nticks = node->GetHitLineCount();
+
+	check_stack_depth();
+
+	/*
+	 * Function bodies start on the line after their header, count their
+	 * lines as error messages do.  The body itself is an anonymous
+	 * function, name it after the plv8 function.
+	 */
+	if (is_plv8)
+	{
+		if (line > 0)
+			line--;
+		if (name[0] == '\0' && line <= 1)
+			name = function->second.second;
+	}
+
+	appendStringInfo(buf, "{\"id\": %u, \"callFrame\": {\"functionName\": ", node->GetNodeId());
+	escape_json(buf, name);
+	appendStringInfo(buf, ", \"scriptId\": \"%d\", \"url\": ", node->GetScriptId());
+	if (is_plv8)
+	{
+		char   *url = psprintf("plv8/%u/%s", function->second.first, function->second.second);
+
+		escape_json(buf, url);
+		pfree(url);
+	}
+	else
+		escape_json(buf, node->GetScriptResourceNameStr());
+	// zero based in the .cpuprofile format
+	appendStringInfo(buf, ", \"lineNumber\": %d, \"columnNumber\": %d}, \"hitCount\": %u",
+					 line - 1, column - 1, node->GetHitCount());
+
+	appendStringInfoString(buf, ", \"children\": [");
+	for (int i = 0; i < node->GetChildrenCount(); i++)
+		appendStringInfo(buf, "%s%u", i > 0 ? ", " : "", node->GetChild(i)->GetNodeId());
+	appendStringInfoChar(buf, ']');
+
+	if (nticks > 0)
+	{
+		std::vector<CpuProfileNode::LineTick>	ticks(nticks);
+
+		if (node->GetLineTicks(ticks.data(), nticks))
+		{
+			appendStringInfoString(buf, ", \"positionTicks\": [");
+			for (unsigned i = 0; i < nticks; i++)
+				appendStringInfo(buf, "%s{\"line\": %d, \"ticks\": %u}", i > 0 ? ", " : "",
+								 is_plv8 ? ticks[i].line - 1 : ticks[i].line, ticks[i].hit_count);
+			appendStringInfoChar(buf, ']');
+		}
+	}
+	appendStringInfoChar(buf, '}');
+
+	for (int i = 0; i < node->GetChildrenCount(); i++)
+	{
+		appendStringInfoString(buf, ", ");
+		append_profile_node(buf, node->GetChild(i), functions);
+	}
+}
+
+/*
+ * The profile as the JSON of a Chrome .cpuprofile file, which DevTools and
+ * most JS profile viewers load.  Scripts of plv8 functions are named after
+ * their pg_proc entries.
+ */
+char *
+plv8_profile_json(plv8_runtime *runtime, const CpuProfile *profile)
+{
+	plv8_script_map		functions;
+	StringInfoData		buf;
+	int64_t				last = profile->GetStartTime();
+
+	plv8_script_functions(runtime, functions);
+
+	initStringInfo(&buf);
+	appendStringInfoString(&buf, "{\"nodes\": [");
+	append_profile_node(&buf, profile->GetTopDownRoot(), functions);
+	appendStringInfo(&buf, "], \"startTime\": " INT64_FORMAT ", \"endTime\": " INT64_FORMAT,
+					 (int64) profile->GetStartTime(), (int64) profile->GetEndTime());
+
+	appendStringInfoString(&buf, ", \"samples\": [");
+	for (int i = 0; i < profile->GetSamplesCount(); i++)
+		appendStringInfo(&buf, "%s%u", i > 0 ? ", " : "", profile->GetSample(i)->GetNodeId());
+	appendStringInfoString(&buf, "], \"timeDeltas\": [");
+	for (int i = 0; i < profile->GetSamplesCount(); i++)
+	{
+		int64_t		timestamp = profile->GetSampleTimestamp(i);
+
+		appendStringInfo(&buf, "%s" INT64_FORMAT, i > 0 ? ", " : "", (int64) (timestamp - last));
+		last = timestamp;
+	}
+	appendStringInfoString(&buf, "]}");
+
+	return buf.data;
+}
+
+/*
+ * Write a profile to filename in PLV8_PROFILE_DIR, created if needed, and
+ * return its path.  Failures are reported at elevel, with a NULL result
+ * below ERROR.
+ */
+char *
+plv8_profile_save(const char *filename, const char *json, int elevel)
+{
+	char	   *path = psprintf("%s/%s", PLV8_PROFILE_DIR, filename);
+	FILE	   *file;
+
+#if PG_VERSION_NUM >= 110000
+	if (MakePGDirectory(PLV8_PROFILE_DIR) < 0 && errno != EEXIST)
+#else
+	if (mkdir(PLV8_PROFILE_DIR, S_IRWXU) < 0 && errno != EEXIST)
+#endif
+	{
+		ereport(elevel,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m", PLV8_PROFILE_DIR)));
+		return NULL;
+	}
+
+	file = AllocateFile(path, PG_BINARY_W);
+	if (file == NULL)
+	{
+		ereport(elevel,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", path)));
+		return NULL;
+	}
+	fputs(json, file);
+	if (FreeFile(file) != 0)
+	{
+		ereport(elevel,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", path)));
+		remove(path);
+		return NULL;
+	}
+
+	return path;
+}
+
+/*
+ * Remove the oldest profiles of plv8.profile_min_duration beyond
+ * plv8.profile_max_files.  Profiles saved by plv8_profile_stop() are named
+ * by users, and left alone.
+ */
+static void
+plv8_profile_cleanup(void)
+{
+	std::vector<std::pair<time_t, std::string>>	files;
+	DIR			   *dir;
+	struct dirent  *de;
+
+	if (plv8_profile_max_files <= 0)
+		return;
+
+	dir = AllocateDir(PLV8_PROFILE_DIR);
+	while ((de = ReadDir(dir, PLV8_PROFILE_DIR)) != NULL)
+	{
+		char		path[MAXPGPATH];
+		struct stat	st;
+		size_t		len = strlen(de->d_name);
+
+		// <oid>.<pid>.<timestamp>.cpuprofile
+		if (len <= strlen(".cpuprofile") ||
+			strspn(de->d_name, "0123456789.") != len - strlen("cpuprofile") ||
+			strcmp(de->d_name + len - strlen("cpuprofile"), "cpuprofile") != 0)
+			continue;
+		snprintf(path, MAXPGPATH, "%s/%s", PLV8_PROFILE_DIR, de->d_name);
+		if (stat(path, &st) == 0)
+			files.emplace_back(st.st_mtime, path);
+	}
+	FreeDir(dir);
+
+	if (files.size() <= (size_t) plv8_profile_max_files)
+		return;
+	std::sort(files.begin(), files.end());
+	for (size_t i = 0; i < files.size() - plv8_profile_max_files; i++)
+	{
+		// other backends may be cleaning up as well
+		if (unlink(files[i].second.c_str()) < 0 && errno != ENOENT)
+			elog(LOG, "could not remove file \"%s\": %m", files[i].second.c_str());
+	}
+}
+
+CallProfile::CallProfile(plv8_runtime *runtime, Oid fn_oid, const char *proname)
+	: m_runtime(nullptr), m_fn_oid(fn_oid)
+{
+	/*
+	 * Nested calls are part of the outer call's profile, and calls of a
+	 * runtime profiled by plv8_profile_start() part of that profile.
+	 */
+	if (plv8_profile_min_duration <= 0 || runtime->call_profiling || runtime->profiling)
+		return;
+
+	strlcpy(m_proname, proname, NAMEDATALEN);
+	StartProfiling(runtime, CALL_PROFILE_TITLE, plv8_profile_interval);
+	runtime->call_profiling = true;
+	m_runtime = runtime;
+}
+
+/*
+ * Calls ending with an error are not saved, the profile is discarded.
+ */
+CallProfile::~CallProfile()
+{
+	if (m_runtime == nullptr)
+		return;
+
+	m_runtime->call_profiling = false;
+	// a killed isolate is disposed of along with its profiler
+	if (m_runtime->wasKilled())
+		return;
+	CpuProfile *profile = StopProfiling(m_runtime, CALL_PROFILE_TITLE);
+	if (profile)
+		profile->Delete();
+}
+
+void
+CallProfile::done()
+{
+	if (m_runtime == nullptr)
+		return;
+
+	CpuProfile *profile = StopProfiling(m_runtime, CALL_PROFILE_TITLE);
+	plv8_runtime *runtime = m_runtime;
+
+	m_runtime->call_profiling = false;
+	m_runtime = nullptr;
+	if (profile == nullptr)
+		return;
+
+	double		duration = (profile->GetEndTime() - profile->GetStartTime()) / 1000.0;
+
+	if (duration >= plv8_profile_min_duration)
+	{
+		PG_TRY();
+		{
+			char   *json = plv8_profile_json(runtime, profile);
+			char   *filename = psprintf("%u.%d." INT64_FORMAT ".cpuprofile", m_fn_oid,
+										MyProcPid, (int64) GetCurrentTimestamp());
+			char   *path = plv8_profile_save(filename, json, LOG);
+
+			if (path != NULL)
+			{
+				elog(LOG, "plv8: profile of %s (%.3f ms) saved to \"%s\"",
+					 m_proname, duration, path);
+				plv8_profile_cleanup();
+			}
+			pfree(json);
+			pfree(filename);
+		}
+		PG_CATCH();
+		{
+			profile->Delete();
+			throw pg_error();
+		}
+		PG_END_TRY();
+	}
+	profile->Delete();
+}
@@ -0,0 +1,46 @@
+#ifndef _PLV8_PROFILE_H_
+#define _PLV8_PROFILE_H_
+
+#include "plv8.h"
+
+/* relative to the data directory */
+#define PLV8_PROFILE_DIR	"plv8_profiles"
+
+/* the plv8 function of each compiled script, by script id */
+typedef std::unordered_map<int, std::pair<Oid, const char *>> plv8_script_map;
+
+/*
+ * Profiles the outermost call of a function when plv8.profile_min_duration
+ * is set, and saves the profile if the call completed in more than that.
+ */
+class CallProfile
+{
+private:
+	plv8_runtime		   *m_runtime;		/* null unless profiling */
+	Oid						m_fn_oid;
+	char					m_proname[NAMEDATALEN];
+
+public:
+	CallProfile(plv8_runtime *runtime, Oid fn_oid, const char *proname);
+	~CallProfile();
+	void done();
+
+private:
+	CallProfile(const CallProfile&);
+	CallProfile& operator = (const CallProfile&);
+};
+
+extern int plv8_profile_min_duration;
+extern int plv8_profile_interval;
+extern int plv8_profile_max_files;
+
+// plv8.cc
+extern void plv8_script_functions(plv8_runtime *runtime, plv8_script_map &functions);
+
+// plv8_profile.cc
+extern void StartProfiling(plv8_runtime *runtime, const char *title, int interval);
+extern v8::CpuProfile *StopProfiling(plv8_runtime *runtime, const char *title);
+extern char *plv8_profile_json(plv8_runtime *runtime, const v8::CpuProfile *profile);
+extern char *plv8_profile_save(const char *filename, const char *json, int elevel);
+
+#endif	// _PLV8_PROFILE_H_
@@ -0,0 +1,419 @@
+/*-------------------------------------------------------------------------
+ *
+ * plv8_stats.cc : per function call statistics in shared memory.
+ *
+ * Copyright (c) 2009-2012, the PLV8JS Development Group.
+ *-------------------------------------------------------------------------
+ */
+#include "plv8_stats.h"
+
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/datum.h"
+#include "utils/hsearch.h"
+} // extern "C"
+
+PGDLLEXPORT Datum	plv8_function_stats(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum	plv8_stats_reset(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(plv8_function_stats);
+PG_FUNCTION_INFO_V1(plv8_stats_reset);
+
+int		plv8_track_functions = 0;
+int		plv8_stats_max_functions = 5000;
+
+typedef struct plv8_stats_key
+{
+	Oid			dbid;
+	Oid			fn_oid;
+} plv8_stats_key;
+
+typedef struct plv8_stats_entry
+{
+	plv8_stats_key			key;
+	plv8_function_counts	counts;
+} plv8_stats_entry;
+
+typedef struct plv8_stats_shared
+{
+	LWLock	   *lock;		/* protects stats_hash */
+} plv8_stats_shared;
+
+/* counts of a function not added to the shared ones yet */
+struct plv8_stats_local
+{
+	Oid						fn_oid;
+	bool					pending;	/* in stats_pending */
+	plv8_function_counts	counts;
+};
+
+static plv8_stats_shared *stats_shared = NULL;
+static HTAB *stats_hash = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+/* never erased, so the call frames can keep pointers to the entries */
+static std::unordered_map<Oid, plv8_stats_local> stats_local;
+static std::vector<plv8_stats_local *> stats_pending;
+static FunctionStats *stats_top = nullptr;
+
+static inline bool
+plv8_stats_enabled()
+{
+	return plv8_track_functions != 0 && stats_hash != NULL;
+}
+
+static plv8_stats_local *
+plv8_stats_lookup(Oid fn_oid)
+{
+	plv8_stats_local   *local = &stats_local[fn_oid];
+
+	local->fn_oid = fn_oid;
+	return local;
+}
+
+/*
+ * The counts of local are about to change, make sure the next flush sees
+ * them.
+ */
+static plv8_function_counts *
+plv8_stats_touch(plv8_stats_local *local)
+{
+	if (!local->pending)
+	{
+		local->pending = true;
+		stats_pending.push_back(local);
+	}
+	return &local->counts;
+}
+
+static Size
+plv8_stats_memsize(void)
+{
+	return add_size(MAXALIGN(sizeof(plv8_stats_shared)),
+					hash_estimate_size(plv8_stats_max_functions, sizeof(plv8_stats_entry)));
+}
+
+#if PG_VERSION_NUM >= 150000
+static void
+plv8_stats_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(plv8_stats_memsize());
+	RequestNamedLWLockTranche("plv8", 1);
+}
+#endif
+
+static void
+plv8_stats_shmem_startup(void)
+{
+	HASHCTL		info = { 0 };
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	stats_shared = (plv8_stats_shared *) ShmemInitStruct("plv8 function stats",
+														 sizeof(plv8_stats_shared),
+														 &found);
+	if (!found)
+		stats_shared->lock = &(GetNamedLWLockTranche("plv8"))->lock;
+
+	info.keysize = sizeof(plv8_stats_key);
+	info.entrysize = sizeof(plv8_stats_entry);
+	stats_hash = ShmemInitHash("plv8 function stats hash",
+							   plv8_stats_max_functions, plv8_stats_max_functions,
+							   &info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Reserve the shared memory of the statistics, only possible while plv8 is
+ * loaded through shared_preload_libraries.
+ */
+void
+plv8_stats_init(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = plv8_stats_shmem_request;
+#else
+	RequestAddinShmemSpace(plv8_stats_memsize());
+	RequestNamedLWLockTranche("plv8", 1);
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = plv8_stats_shmem_startup;
+}
+
+/*
+ * Add the counts of this backend to the shared ones, called at the end of
+ * each transaction.  Functions that don't fit in plv8.stats_max_functions
+ * are not counted.  On abort, the call frames may have been jumped over by
+ * elog(ERROR) without running their destructors, forget them.
+ */
+void
+plv8_stats_flush(bool abort)
+{
+	if (abort)
+		stats_top = nullptr;
+	if (stats_pending.empty())
+		return;
+
+	if (stats_hash != NULL)
+	{
+		LWLockAcquire(stats_shared->lock, LW_EXCLUSIVE);
+		for (auto local: stats_pending)
+		{
+			plv8_stats_key		key = { 0 };
+			plv8_stats_entry   *entry;
+			bool				found;
+
+			key.dbid = MyDatabaseId;
+			key.fn_oid = local->fn_oid;
+			entry = (plv8_stats_entry *) hash_search(stats_hash, &key, HASH_FIND, NULL);
+			if (entry == NULL &&
+				hash_get_num_entries(stats_hash) < plv8_stats_max_functions)
+			{
+				// never error out while holding the lock at the end of a transaction
+				entry = (plv8_stats_entry *) hash_search(stats_hash, &key, HASH_ENTER_NULL, &found);
+				if (entry != NULL && !found)
+					memset(&entry->counts, 0, sizeof(entry->counts));
+			}
+			if (entry != NULL)
+			{
+				plv8_function_counts   *shared = &entry->counts;
+				plv8_function_counts   *counts = &local->counts;
+
+				shared->calls += counts->calls;
+				shared->compiles += counts->compiles;
+				shared->exceptions += counts->exceptions;
+				shared->bytes_converted += counts->bytes_converted;
+				INSTR_TIME_ADD(shared->total_time, counts->total_time);
+				INSTR_TIME_ADD(shared->self_time, counts->self_time);
+				INSTR_TIME_ADD(shared->compile_time, counts->compile_time);
+				INSTR_TIME_ADD(shared->convert_time, counts->convert_time);
+				INSTR_TIME_ADD(shared->spi_time, counts->spi_time);
+			}
+		}
+		LWLockRelease(stats_shared->lock);
+	}
+
+	for (auto local: stats_pending)
+	{
+		memset(&local->counts, 0, sizeof(local->counts));
+		local->pending = false;
+	}
+	stats_pending.clear();
+}
+
+FunctionStats::FunctionStats(Oid fn_oid)
+	: m_local(nullptr), m_prev(nullptr), m_done(false)
+{
+	if (!plv8_stats_enabled())
+		return;
+
+	m_local = plv8_stats_lookup(fn_oid);
+	m_prev = stats_top;
+	stats_top = this;
+	INSTR_TIME_SET_ZERO(m_children);
+	INSTR_TIME_SET_CURRENT(m_start);
+}
+
+FunctionStats::~FunctionStats()
+{
+	if (m_local == nullptr)
+		return;
+
+	plv8_function_counts   *counts = plv8_stats_touch(m_local);
+	instr_time				elapsed;
+	instr_time				self;
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, m_start);
+	self = elapsed;
+	INSTR_TIME_SUBTRACT(self, m_children);
+
+	counts->calls++;
+	if (!m_done)
+		counts->exceptions++;
+	INSTR_TIME_ADD(counts->total_time, elapsed);
+	INSTR_TIME_ADD(counts->self_time, self);
+
+	stats_top = m_prev;
+	if (m_prev != nullptr)
+		INSTR_TIME_ADD(m_prev->m_children, elapsed);
+}
+
+StatsTimer::StatsTimer(plv8_stats_kind kind, Oid fn_oid)
+	: m_local(nullptr), m_kind(kind)
+{
+	if (!plv8_stats_enabled())
+		return;
+
+	if (OidIsValid(fn_oid))
+		m_local = plv8_stats_lookup(fn_oid);
+	else if (stats_top != nullptr)
+		m_local = stats_top->m_local;
+	if (m_local != nullptr)
+		INSTR_TIME_SET_CURRENT(m_start);
+}
+
+StatsTimer::~StatsTimer()
+{
+	if (m_local == nullptr)
+		return;
+
+	plv8_function_counts   *counts = plv8_stats_touch(m_local);
+	instr_time				elapsed;
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, m_start);
+
+	switch (m_kind)
+	{
+		case PLV8_STATS_COMPILE:
+			counts->compiles++;
+			INSTR_TIME_ADD(counts->compile_time, elapsed);
+			break;
+		case PLV8_STATS_CONVERT:
+			INSTR_TIME_ADD(counts->convert_time, elapsed);
+			break;
+		case PLV8_STATS_SPI:
+			INSTR_TIME_ADD(counts->spi_time, elapsed);
+			break;
+	}
+}
+
+/*
+ * Count a datum converted for the function being called.
+ */
+void
+plv8_stats_datum(Datum value, bool isnull, plv8_type *type)
+{
+	if (stats_top == nullptr || isnull)
+		return;
+
+	plv8_stats_touch(stats_top->m_local)->bytes_converted +=
+		datumGetSize(value, type->byval, type->len);
+}
+
+void
+plv8_stats_bytes(size_t bytes)
+{
+	if (stats_top == nullptr)
+		return;
+
+	plv8_stats_touch(stats_top->m_local)->bytes_converted += bytes;
+}
+
+static void
+plv8_stats_check(void)
+{
+	if (stats_hash == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("plv8 function statistics require plv8 in shared_preload_libraries")));
+}
+
+/*
+ * plv8_function_stats() -- the shared counters of the functions of the
+ * current database.
+ */
+Datum
+plv8_function_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	MemoryContext		oldcontext;
+	HASH_SEQ_STATUS		status;
+	plv8_stats_entry   *entry;
+
+	plv8_stats_check();
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+	MemoryContextSwitchTo(oldcontext);
+
+	LWLockAcquire(stats_shared->lock, LW_SHARED);
+	hash_seq_init(&status, stats_hash);
+	while ((entry = (plv8_stats_entry *) hash_seq_search(&status)) != NULL)
+	{
+		plv8_function_counts   *counts = &entry->counts;
+		Datum					values[10];
+		bool					nulls[10] = {};
+
+		if (entry->key.dbid != MyDatabaseId)
+			continue;
+
+		values[0] = ObjectIdGetDatum(entry->key.fn_oid);
+		values[1] = Int64GetDatum(counts->calls);
+		values[2] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(counts->total_time));
+		values[3] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(counts->self_time));
+		values[4] = Int64GetDatum(counts->compiles);
+		values[5] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(counts->compile_time));
+		values[6] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(counts->convert_time));
+		values[7] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(counts->spi_time));
+		values[8] = Int64GetDatum(counts->bytes_converted);
+		values[9] = Int64GetDatum(counts->exceptions);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	LWLockRelease(stats_shared->lock);
+
+	return (Datum) 0;
+}
+
+/*
+ * plv8_stats_reset() -- discard the counters of the current database.
+ */
+Datum
+plv8_stats_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS		status;
+	plv8_stats_entry   *entry;
+
+	plv8_stats_check();
+
+	LWLockAcquire(stats_shared->lock, LW_EXCLUSIVE);
+	hash_seq_init(&status, stats_hash);
+	while ((entry = (plv8_stats_entry *) hash_seq_search(&status)) != NULL)
+	{
+		if (entry->key.dbid == MyDatabaseId)
+			hash_search(stats_hash, &entry->key, HASH_REMOVE, NULL);
+	}
+	LWLockRelease(stats_shared->lock);
+
+	return (Datum) 0;
+}
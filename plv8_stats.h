@@ -0,0 +1,92 @@
+#ifndef _PLV8_STATS_H_
+#define _PLV8_STATS_H_
+
+#include "plv8.h"
+
+extern "C" {
+#include "portability/instr_time.h"
+} // extern "C"
+
+/*
+ * Counters of a function, kept by each backend and added to the shared
+ * ones at the end of the transaction, see pg_stat_plv8_functions.
+ */
+typedef struct plv8_function_counts
+{
+	int64		calls;
+	int64		compiles;
+	int64		exceptions;			/* calls ending with an error */
+	int64		bytes_converted;	/* of arguments and results */
+	instr_time	total_time;
+	instr_time	self_time;			/* not in nested plv8 calls */
+	instr_time	compile_time;
+	instr_time	convert_time;
+	instr_time	spi_time;
+} plv8_function_counts;
+
+struct plv8_stats_local;
+
+typedef enum plv8_stats_kind
+{
+	PLV8_STATS_COMPILE,
+	PLV8_STATS_CONVERT,
+	PLV8_STATS_SPI
+} plv8_stats_kind;
+
+/*
+ * A call of a function, timed from construction to destruction.  Calls
+ * that are not marked done() count as exceptions.
+ */
+class FunctionStats
+{
+private:
+	plv8_stats_local	   *m_local;
+	FunctionStats		   *m_prev;
+	instr_time				m_start;
+	instr_time				m_children;		/* spent in nested calls */
+	bool					m_done;
+
+	friend class StatsTimer;
+	friend void plv8_stats_datum(Datum value, bool isnull, plv8_type *type);
+	friend void plv8_stats_bytes(size_t bytes);
+
+public:
+	explicit FunctionStats(Oid fn_oid);
+	~FunctionStats();
+	void done() { m_done = true; }
+
+private:
+	FunctionStats(const FunctionStats&);
+	FunctionStats& operator = (const FunctionStats&);
+};
+
+/*
+ * Times a compilation of fn_oid, or a conversion or SPI call of the
+ * function being called.
+ */
+class StatsTimer
+{
+private:
+	plv8_stats_local	   *m_local;
+	plv8_stats_kind			m_kind;
+	instr_time				m_start;
+
+public:
+	explicit StatsTimer(plv8_stats_kind kind, Oid fn_oid = InvalidOid);
+	~StatsTimer();
+
+private:
+	StatsTimer(const StatsTimer&);
+	StatsTimer& operator = (const StatsTimer&);
+};
+
+extern int plv8_track_functions;
+extern int plv8_stats_max_functions;
+
+// plv8_stats.cc
+extern void plv8_stats_init(void);
+extern void plv8_stats_flush(bool abort);
+extern void plv8_stats_datum(Datum value, bool isnull, plv8_type *type);
+extern void plv8_stats_bytes(size_t bytes);
+
+#endif	// _PLV8_STATS_H_
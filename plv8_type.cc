@@ -20,6 +20,8 @@ extern "C" {
 #include "utils/date.h"
 #include "utils/datetime.h"
 #include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
 #if PG_VERSION_NUM >= 90400
 #include "utils/jsonb.h"
 #endif
@@ -45,19 +47,117 @@ static Datum EpochToTimestampTz(double epoch);
 static double DateToEpoch(DateADT date);
 static Datum EpochToDate(double epoch);
 
-void
-plv8_fill_type(plv8_type *type, Oid typid, MemoryContext mcxt)
+/*
+ * Backend-wide cache of what plv8_fill_type() and the I/O function lookups
+ * find out about a type, so that setting up a call or a conversion needs
+ * no syscache lookups once a type has been seen.  Entries are dropped by
+ * the pg_type syscache callback.
+ */
+typedef struct plv8_type_cache_entry
+{
+	Oid			typid;				/* hash key */
+	uint32		hashvalue;			/* TYPEOID syscache hash of typid */
+	uint32		elem_hashvalue;		/* same for the element of an array */
+
+	/* typid itself */
+	char		category;
+	int16		len;
+	bool		byval;
+	char		align;
+
+	/* the result of plv8_fill_type() */
+	bool		filled;
+	plv8_type	type;
+
+	/* I/O functions of typid, copied into plv8_type with fmgr_info_copy() */
+	bool		has_input;
+	bool		has_output;
+	Oid			ioparam;
+	FmgrInfo	input;
+	FmgrInfo	output;
+} plv8_type_cache_entry;
+
+static HTAB *plv8_type_cache = NULL;
+static MemoryContext plv8_type_cache_context = NULL;
+
+static void
+InvalidateTypeCache(Datum arg, int cacheid, uint32 hashvalue)
 {
-	bool    ispreferred;
+	HASH_SEQ_STATUS			status;
+	plv8_type_cache_entry  *entry;
 
-	if (!mcxt)
-		mcxt = CurrentMemoryContext;
+	hash_seq_init(&status, plv8_type_cache);
+	while ((entry = (plv8_type_cache_entry *) hash_seq_search(&status)) != NULL)
+	{
+		if (hashvalue == 0 || entry->hashvalue == hashvalue ||
+			entry->elem_hashvalue == hashvalue)
+			hash_search(plv8_type_cache, &entry->typid, HASH_REMOVE, NULL);
+	}
+}
+
+static plv8_type_cache_entry *
+GetTypeInfo(Oid typid)
+{
+	plv8_type_cache_entry  *entry;
+	bool					found;
+	bool					ispreferred;
+
+	if (plv8_type_cache == NULL)
+	{
+		HASHCTL		hash_ctl = { 0 };
+
+#if PG_VERSION_NUM < 110000
+		plv8_type_cache_context = AllocSetContextCreate(CacheMemoryContext,
+														"PLV8 type cache",
+														ALLOCSET_SMALL_MINSIZE,
+														ALLOCSET_SMALL_INITSIZE,
+														ALLOCSET_SMALL_MAXSIZE);
+#else
+		plv8_type_cache_context = AllocSetContextCreate(CacheMemoryContext,
+														"PLV8 type cache",
+														ALLOCSET_SMALL_SIZES);
+#endif
+		hash_ctl.keysize = sizeof(Oid);
+		hash_ctl.entrysize = sizeof(plv8_type_cache_entry);
+		hash_ctl.hcxt = plv8_type_cache_context;
+		plv8_type_cache = hash_create("PLV8 type cache", 64, &hash_ctl,
+									  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+		CacheRegisterSyscacheCallback(TYPEOID, InvalidateTypeCache, (Datum) 0);
+	}
+
+	entry = (plv8_type_cache_entry *)
+		hash_search(plv8_type_cache, &typid, HASH_FIND, NULL);
+	if (entry != NULL)
+		return entry;
+
+	/*
+	 * Look everything up before entering the entry, the lookups could fail
+	 * or run the invalidation callback.
+	 */
+	plv8_type_cache_entry	tmp = {};
+
+	tmp.typid = typid;
+	tmp.hashvalue = GetSysCacheHashValue1(TYPEOID, ObjectIdGetDatum(typid));
+	get_type_category_preferred(typid, &tmp.category, &ispreferred);
+	get_typlenbyvalalign(typid, &tmp.len, &tmp.byval, &tmp.align);
+
+	entry = (plv8_type_cache_entry *)
+		hash_search(plv8_type_cache, &typid, HASH_ENTER, &found);
+	*entry = tmp;
+	return entry;
+}
+
+static void
+FillType(plv8_type *type, Oid typid, uint32 *elem_hashvalue)
+{
+	plv8_type_cache_entry  *entry = GetTypeInfo(typid);
 
 	type->typid = typid;
-	type->fn_input.fn_mcxt = type->fn_output.fn_mcxt = mcxt;
-	get_type_category_preferred(typid, &type->category, &ispreferred);
+	type->category = entry->category;
 	type->is_composite = (type->category == TYPCATEGORY_COMPOSITE);
-	get_typlenbyvalalign(typid, &type->len, &type->byval, &type->align);
+	type->len = entry->len;
+	type->byval = entry->byval;
+	type->align = entry->align;
 
 	if (get_typtype(typid) == TYPTYPE_DOMAIN)
 	{
@@ -120,10 +220,86 @@ plv8_fill_type(plv8_type *type, Oid typid, MemoryContext mcxt)
 			ereport(ERROR,
 				(errmsg("cannot determine element type of array: %u", typid)));
 
+		plv8_type_cache_entry  *elem = GetTypeInfo(elemid);
+
+		*elem_hashvalue = elem->hashvalue;
 		type->typid = elemid;
-		type->is_composite = (TypeCategory(elemid) == TYPCATEGORY_COMPOSITE);
-		get_typlenbyvalalign(type->typid, &type->len, &type->byval, &type->align);
+		type->is_composite = (elem->category == TYPCATEGORY_COMPOSITE);
+		type->len = elem->len;
+		type->byval = elem->byval;
+		type->align = elem->align;
+	}
+}
+
+void
+plv8_fill_type(plv8_type *type, Oid typid, MemoryContext mcxt)
+{
+	plv8_type_cache_entry  *entry;
+
+	if (!mcxt)
+		mcxt = CurrentMemoryContext;
+
+	entry = GetTypeInfo(typid);
+	if (!entry->filled)
+	{
+		plv8_type	filled = {};
+		uint32		elem_hashvalue = 0;
+
+		/* the lookups may run the invalidation callback, look it up again */
+		FillType(&filled, typid, &elem_hashvalue);
+		entry = GetTypeInfo(typid);
+		entry->type = filled;
+		entry->elem_hashvalue = elem_hashvalue;
+		entry->filled = true;
 	}
+
+	*type = entry->type;
+	type->fn_input.fn_addr = type->fn_output.fn_addr = NULL;
+	type->fn_input.fn_mcxt = type->fn_output.fn_mcxt = mcxt;
+}
+
+/*
+ * Set up the input function of the type, as resolved in the type cache.
+ */
+static void
+FillTypeInput(plv8_type *type)
+{
+	plv8_type_cache_entry  *entry = GetTypeInfo(type->typid);
+
+	if (!entry->has_input)
+	{
+		Oid		input_func;
+		Oid		ioparam;
+
+		getTypeInputInfo(type->typid, &input_func, &ioparam);
+		entry = GetTypeInfo(type->typid);
+		fmgr_info_cxt(input_func, &entry->input, plv8_type_cache_context);
+		entry->ioparam = ioparam;
+		entry->has_input = true;
+	}
+	type->ioparam = entry->ioparam;
+	fmgr_info_copy(&type->fn_input, &entry->input, type->fn_input.fn_mcxt);
+}
+
+/*
+ * Set up the output function of the type, as resolved in the type cache.
+ */
+static void
+FillTypeOutput(plv8_type *type)
+{
+	plv8_type_cache_entry  *entry = GetTypeInfo(type->typid);
+
+	if (!entry->has_output)
+	{
+		Oid		output_func;
+		bool	isvarlen;
+
+		getTypeOutputInfo(type->typid, &output_func, &isvarlen);
+		entry = GetTypeInfo(type->typid);
+		fmgr_info_cxt(output_func, &entry->output, plv8_type_cache_context);
+		entry->has_output = true;
+	}
+	fmgr_info_copy(&type->fn_output, &entry->output, type->fn_output.fn_mcxt);
 }
 
 /*
@@ -816,12 +992,7 @@ ToScalarDatum(Handle<v8::Value> value, bool *isnull, plv8_type *type)
 	PG_TRY();
 	{
 		if (type->fn_input.fn_addr == NULL)
-		{
-			Oid    input_func;
-
-			getTypeInputInfo(type->typid, &input_func, &type->ioparam);
-			fmgr_info_cxt(input_func, &type->fn_input, type->fn_input.fn_mcxt);
-		}
+			FillTypeInput(type);
 		result = InputFunctionCall(&type->fn_input, str, type->ioparam, -1);
 	}
 	PG_CATCH();
@@ -1065,15 +1236,26 @@ ToArrayValue(Datum datum, bool isnull, plv8_type *type)
 						&values, &nulls, &nelems);
 	Local<Array>  result = Array::New(isolate, nelems);
 	plv8_type base = { 0 };
-	bool    ispreferred;
+	plv8_type_cache_entry *entry;
 
 	base.typid = type->typid;
 	if (base.typid == RECORDARRAYOID)
 		base.typid = RECORDOID;
 
 	base.fn_input.fn_mcxt = base.fn_output.fn_mcxt = type->fn_input.fn_mcxt;
-	get_type_category_preferred(base.typid, &(base.category), &ispreferred);
-	get_typlenbyvalalign(base.typid, &(base.len), &(base.byval), &(base.align));
+	PG_TRY();
+	{
+		entry = GetTypeInfo(base.typid);
+	}
+	PG_CATCH();
+	{
+		throw pg_error();
+	}
+	PG_END_TRY();
+	base.category = entry->category;
+	base.len = entry->len;
+	base.byval = entry->byval;
+	base.align = entry->align;
 
 	for (int i = 0; i < nelems; i++)
 		result->Set(context, i, ToValue(values[i], nulls[i], &base)).Check();
@@ -1130,13 +1312,7 @@ ToString(Datum value, plv8_type *type)
 	PG_TRY();
 	{
 		if (type->fn_output.fn_addr == NULL)
-		{
-			Oid		output_func;
-			bool	isvarlen;
-
-			getTypeOutputInfo(type->typid, &output_func, &isvarlen);
-			fmgr_info_cxt(output_func, &type->fn_output, type->fn_output.fn_mcxt);
-		}
+			FillTypeOutput(type);
 		str = OutputFunctionCall(&type->fn_output, value);
 	}
 	PG_CATCH();
@@ -0,0 +1,48 @@
+-- ArrayBuffers are allocated by plv8 within plv8.memory_limit
+SET plv8.v8_flags = '--expose-gc --single-threaded-gc';
+-- buffers up to 1MB are pooled by power of two size class, and reused once collected
+DO $$ (() => new ArrayBuffer(1000))(); gc(); $$ LANGUAGE plv8;
+SELECT (a->>'pooled')::int AS pooled, (a->>'reserved')::int AS reserved,
+       (a->>'pool_hits')::int AS pool_hits, (a->>'pool_misses')::int AS pool_misses
+  FROM (SELECT plv8_info()->0->'array_buffers' AS a) s;
+DO $$ (() => new ArrayBuffer(600))(); gc(); $$ LANGUAGE plv8;
+SELECT (a->>'pooled')::int AS pooled, (a->>'reserved')::int AS reserved,
+       (a->>'pool_hits')::int AS pool_hits, (a->>'pool_misses')::int AS pool_misses
+  FROM (SELECT plv8_info()->0->'array_buffers' AS a) s;
+-- larger ones are mapped, and unmapped once collected
+DO $$ globalThis.big = new ArrayBuffer(2 * 1024 * 1024 + 1) $$ LANGUAGE plv8;
+SELECT (a->>'mapped')::int8 > 2 * 1024 * 1024 AS mapped, (a->>'pooled')::int AS pooled
+  FROM (SELECT plv8_info()->0->'array_buffers' AS a) s;
+DO $$ delete globalThis.big; gc(); $$ LANGUAGE plv8;
+SELECT (a->>'mapped')::int8 AS mapped, (a->>'pooled')::int AS pooled
+  FROM (SELECT plv8_info()->0->'array_buffers' AS a) s;
+-- crossing 80% of plv8.memory_limit asks V8 for an incremental GC once
+DO $$
+  const limit = plv8.execute(`select setting from pg_settings where name = $1`, ['plv8.memory_limit'])[0].setting;
+  (() => new ArrayBuffer(limit * 1024 * 1024 * 0.85))();
+  gc();
+$$ LANGUAGE plv8;
+SELECT (a->>'soft_limit_hits')::int AS soft_limit_hits, (a->>'failed_allocations')::int AS failed_allocations
+  FROM (SELECT plv8_info()->0->'array_buffers' AS a) s;
+SELECT array_buffers, array_buffers_peak > current_setting('plv8.memory_limit')::int8 * 1024 * 1024 * 0.8 AS peak
+  FROM plv8_runtime_stats() WHERE context IS NULL;
+-- crossing plv8.memory_limit fails the allocation with a RangeError, and only that one
+DO $$
+  const limit = plv8.execute(`select setting from pg_settings where name = $1`, ['plv8.memory_limit'])[0].setting;
+  try {
+    new ArrayBuffer(limit * 1024 * 1024);
+  } catch (e) {
+    plv8.elog(NOTICE, e);
+  }
+  plv8.elog(NOTICE, new ArrayBuffer(1024).byteLength);
+$$ LANGUAGE plv8;
+SELECT (a->>'soft_limit_hits')::int AS soft_limit_hits, (a->>'failed_allocations')::int > 0 AS failed
+  FROM (SELECT plv8_info()->0->'array_buffers' AS a) s;
+-- at transaction end, at most 4MB of collected buffers stay in the pool
+BEGIN;
+DO $$ (() => { for (let i = 0; i < 8; i++) new ArrayBuffer(1024 * 1024) })(); gc(); $$ LANGUAGE plv8;
+SELECT (a->>'pooled')::int > 4 * 1024 * 1024 AS pooled
+  FROM (SELECT plv8_info()->0->'array_buffers' AS a) s;
+COMMIT;
+SELECT (a->>'pooled')::int BETWEEN 1 AND 4 * 1024 * 1024 AS pooled
+  FROM (SELECT plv8_info()->0->'array_buffers' AS a) s;
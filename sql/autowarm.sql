@@ -0,0 +1,32 @@
+-- functions used by a backend are compiled before the first call of the next ones
+CREATE FUNCTION aw_a() RETURNS int AS $$ return 1 $$ LANGUAGE plv8;
+CREATE FUNCTION aw_b() RETURNS int AS $$ return 2 $$ LANGUAGE plv8;
+CREATE FUNCTION aw_c() RETURNS int AS $$ return 3 $$ LANGUAGE plv8;
+CREATE TABLE aw_started AS SELECT date_trunc('second', now()) AS started;
+SET plv8.autowarm_size = 10;
+SELECT aw_a(), aw_b(), aw_c();
+\c
+-- the previous backend saves its functions as it exits
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		EXIT WHEN (pg_stat_file('plv8_autowarm.' || (SELECT oid FROM pg_database WHERE datname = current_database()), true)).modification
+				  >= (SELECT started FROM aw_started);
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END
+$$;
+-- functions dropped or failing to compile are skipped
+DROP FUNCTION aw_c();
+SET check_function_bodies = off;
+CREATE OR REPLACE FUNCTION aw_b() RETURNS int AS '@' LANGUAGE plv8;
+RESET check_function_bodies;
+SET plv8.autowarm_size = 10;
+SELECT aw_a();
+SELECT (c->>'functions')::int AS functions, (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM plv8_function_cache() c;
+SELECT aw_b();
+RESET plv8.autowarm_size;
+DROP TABLE aw_started;
+DROP FUNCTION aw_a();
+DROP FUNCTION aw_b();
@@ -0,0 +1,23 @@
+-- functions compiled again reuse the V8 code cache of their source
+SET plv8.function_cache_size = 1;
+CREATE FUNCTION cc_err(n int) RETURNS int AS $$
+  if (n > 0)
+    throw new Error('n is ' + n);
+  return n;
+$$ LANGUAGE plv8;
+CREATE FUNCTION cc_other() RETURNS int AS $$ return 1 $$ LANGUAGE plv8;
+SELECT cc_err(0);
+SELECT cc_other();
+SELECT (c->>'compiled')::int AS compiled, (c->>'compiled_hits')::int AS compiled_hits
+  FROM plv8_function_cache() c;
+-- errors keep their line numbers
+SELECT cc_err(1);
+SELECT (c->>'compiled')::int AS compiled, (c->>'compiled_hits')::int AS compiled_hits
+  FROM plv8_function_cache() c;
+-- the code caches of changed functions are released
+CREATE OR REPLACE FUNCTION cc_other() RETURNS int AS $$ return 2 $$ LANGUAGE plv8;
+SELECT (c->>'compiled')::int AS compiled, (c->>'compiled_hits')::int AS compiled_hits
+  FROM plv8_function_cache() c;
+RESET plv8.function_cache_size;
+DROP FUNCTION cc_err(int);
+DROP FUNCTION cc_other();
@@ -0,0 +1,14 @@
+-- contexts measured over plv8.context_cache_budget are evicted to make room
+SET plv8.v8_flags = '--expose-gc';
+SET plv8.context_cache_budget = 1;
+SET plv8.context = 'budget_a';
+DO $$ globalThis.big = Array.from({ length: 200000 }, (x, i) => ({ i })) $$ LANGUAGE plv8;
+-- the measurement requested at the end of the last transaction completes with a GC
+DO $$ gc() $$ LANGUAGE plv8;
+SET plv8.context = 'budget_b';
+DO $$ plv8.elog(NOTICE, 'budget_b') $$ LANGUAGE plv8;
+SELECT context, evicted FROM plv8_context_stats WHERE context LIKE 'budget_%' ORDER BY context;
+SET plv8.context = 'budget_a';
+DO $$ plv8.elog(NOTICE, typeof big) $$ LANGUAGE plv8;
+RESET plv8.context;
+RESET plv8.context_cache_budget;
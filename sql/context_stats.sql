@@ -0,0 +1,39 @@
+-- per context accounting and quotas
+DO $$ plv8.elog(NOTICE, 'not accounted') $$ LANGUAGE plv8;
+SELECT count(*) FROM plv8_context_stats;
+SET plv8.track_contexts = 1;
+SET plv8.context = 'stats_a';
+DO $$ let x = 0; for (let i = 0; i < 10; i++) x += i; $$ LANGUAGE plv8;
+DO $$ plv8.execute('SELECT 1') $$ LANGUAGE plv8;
+SELECT context, calls, throttled, failed, evicted FROM plv8_context_stats WHERE context = 'stats_a';
+
+-- a fixed amount of work, far over 1ms of CPU time, in a context with no usage yet
+SET plv8.context = 'stats_q';
+SET plv8.context_cpu_hard_quota = 1;
+DO $$ let x = 0; for (let i = 0; i < 50000000; i++) x += i % 7; $$ LANGUAGE plv8;
+DO $$ plv8.elog(NOTICE, 'not reached') $$ LANGUAGE plv8;
+SELECT context, calls, failed FROM plv8_context_stats WHERE context = 'stats_q';
+
+-- over the soft quota, calls coming too soon after the previous one wait
+RESET plv8.context_cpu_hard_quota;
+SET plv8.context = 'stats_s';
+SET plv8.context_cpu_soft_quota = 1;
+DO $$ let x = 0; for (let i = 0; i < 50000000; i++) x += i % 7; $$ LANGUAGE plv8;
+DO $$ plv8.elog(NOTICE, 'throttled') $$ LANGUAGE plv8;
+SELECT context, calls, throttled, failed FROM plv8_context_stats WHERE context = 'stats_s';
+RESET plv8.context_cpu_soft_quota;
+SET plv8.context_cpu_hard_quota = 1;
+
+-- other contexts are not affected
+SET plv8.context = 'stats_b';
+DO $$ plv8.elog(NOTICE, 'stats_b') $$ LANGUAGE plv8;
+RESET plv8.context_cpu_hard_quota;
+RESET plv8.context;
+RESET plv8.track_contexts;
+SELECT context, calls, failed FROM plv8_context_stats WHERE context LIKE 'stats_%' ORDER BY context;
+
+-- runtime statistics
+SELECT count(*) AS runtimes, bool_and(heap_size > 0 AND code_size > 0
+	AND array_length(gc_pauses, 1) = 8) AS ok
+	FROM plv8_runtime_stats() WHERE context IS NULL;
+SELECT context FROM plv8_runtime_stats() WHERE context LIKE 'stats_%' ORDER BY context;
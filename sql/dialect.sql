@@ -18,3 +18,31 @@ return plv8.find_function('v8func')(a);
 $$ LANGUAGE plls;
 
 SELECT lsfunc(11);
+
+-- other runtimes load the compilers from the code cache of the first one
+CREATE ROLE dialect_user;
+SET ROLE TO dialect_user;
+DO LANGUAGE plcoffee $$ plv8.elog(INFO, "bar") $$;
+DO LANGUAGE plls $$ plv8.elog(INFO, "bar") $$;
+RESET ROLE;
+SELECT (c->>'compiler_cache_hits')::int AS hits, (c->>'compiler_cache_rejected')::int AS rejected
+  FROM plv8_function_cache() c;
+DROP ROLE dialect_user;
+
+-- functions compiled by the validator are kept once they are committed
+SELECT (c->>'misses')::int AS misses FROM plv8_function_cache() c \gset
+CREATE FUNCTION coffee_one() RETURNS int AS $$
+return 1
+$$ LANGUAGE plcoffee;
+SELECT coffee_one();
+SELECT (c->>'misses')::int - :misses AS misses FROM plv8_function_cache() c;
+DROP FUNCTION coffee_one();
+
+-- DO blocks are cached separately for each dialect
+SELECT (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM (SELECT plv8_info()->0->'eval_cache' AS c) s \gset
+DO LANGUAGE plv8 $$ plv8.elog(INFO, "baz") $$;
+DO LANGUAGE plcoffee $$ plv8.elog(INFO, "baz") $$;
+DO LANGUAGE plcoffee $$ plv8.elog(INFO, "baz") $$;
+SELECT (c->>'hits')::int - :hits AS hits, (c->>'misses')::int - :misses AS misses
+  FROM (SELECT plv8_info()->0->'eval_cache' AS c) s;
@@ -0,0 +1,41 @@
+-- plv8_eval() and plv8.compile() share a cache of compiled sources
+SELECT plv8_eval('return args.a + args.b', '{"a": 1, "b": 2}'::jsonb);
+SELECT plv8_eval('return args.a + args.b', '{"a": 3, "b": 4}'::jsonb);
+SELECT plv8_eval('return args.map(x => x * 2)', ARRAY[1, 2, 3]);
+SELECT plv8_eval('return "x" + 1');
+DO $$ plv8.elog(NOTICE, plv8.compile('return args.a + args.b')({a: 5, b: 6})); $$ LANGUAGE plv8;
+SELECT (c->>'functions')::int AS functions, (c->>'evicted')::int AS evicted,
+       (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM (SELECT plv8_info()->0->'eval_cache' AS c) s;
+-- least recently used sources are released
+SET plv8.eval_cache_size = 1;
+SELECT plv8_eval('return 2');
+SELECT (c->>'functions')::int AS functions, (c->>'evicted')::int AS evicted,
+       (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM (SELECT plv8_info()->0->'eval_cache' AS c) s;
+-- plv8.max_eval_size applies
+SET plv8.max_eval_size = 10;
+SELECT plv8_eval('return args');
+RESET plv8.max_eval_size;
+RESET plv8.eval_cache_size;
+-- DO blocks are cached too, separately for each plv8.context
+SELECT (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM (SELECT plv8_info()->0->'eval_cache' AS c) s \gset
+DO $$ plv8.elog(NOTICE, 'do block') $$ LANGUAGE plv8;
+DO $$ plv8.elog(NOTICE, 'do block') $$ LANGUAGE plv8;
+SET plv8.context = 'eval_ctx';
+DO $$ plv8.elog(NOTICE, 'do block') $$ LANGUAGE plv8;
+RESET plv8.context;
+SELECT (c->>'hits')::int - :hits AS hits, (c->>'misses')::int - :misses AS misses
+  FROM (SELECT plv8_info()->0->'eval_cache' AS c) s;
+-- plv8_eval() needs USAGE on the language, as DO blocks do
+CREATE ROLE eval_user;
+REVOKE USAGE ON LANGUAGE plv8 FROM PUBLIC;
+SET ROLE TO eval_user;
+SELECT plv8_eval('return 1');
+RESET ROLE;
+GRANT USAGE ON LANGUAGE plv8 TO PUBLIC;
+SET ROLE TO eval_user;
+SELECT plv8_eval('return 1');
+RESET ROLE;
+DROP ROLE eval_user;
@@ -0,0 +1,31 @@
+-- the receiver of a function is kept across transactions
+CREATE FUNCTION xe_count() RETURNS int AS $$ this.n = (this.n || 0) + 1; return this.n $$ LANGUAGE plv8;
+CREATE FUNCTION xe_fail() RETURNS int AS $$ throw new Error('xe_fail') $$ LANGUAGE plv8;
+SELECT xe_count();
+SELECT xe_count();
+BEGIN;
+SELECT xe_count();
+COMMIT;
+-- and replaced after a transaction aborts
+BEGIN;
+SELECT xe_count();
+ROLLBACK;
+SELECT xe_count();
+BEGIN;
+SELECT xe_count();
+SELECT xe_fail();
+ROLLBACK;
+SELECT xe_count();
+-- receivers released within a transaction stay until its end, even when the runtime goes away
+BEGIN;
+SELECT xe_count();
+CREATE OR REPLACE FUNCTION xe_count() RETURNS int AS $$ this.n = (this.n || 0) + 1; return this.n $$ LANGUAGE plv8;
+SELECT xe_count();
+SELECT plv8_reset_contexts();
+SELECT xe_count();
+SELECT plv8_reset();
+SELECT xe_count();
+COMMIT;
+SELECT xe_count();
+DROP FUNCTION xe_count();
+DROP FUNCTION xe_fail();
@@ -0,0 +1,55 @@
+-- plv8.find_function() follows search_path, redefinitions, privileges and role memberships
+CREATE SCHEMA ff_a;
+CREATE SCHEMA ff_b;
+CREATE FUNCTION ff_a.ff_target() RETURNS text AS $$ return 'a' $$ LANGUAGE plv8;
+CREATE FUNCTION ff_b.ff_target() RETURNS text AS $$ return 'b' $$ LANGUAGE plv8;
+CREATE FUNCTION public.ff_call(sig text) RETURNS text AS $$
+  try {
+    const func = plv8.find_function(sig);
+    return func === undefined ? 'denied' : func();
+  } catch (e) {
+    return e.message;
+  }
+$$ LANGUAGE plv8;
+SET search_path = ff_a, public;
+SELECT ff_call('ff_target');
+SET search_path = ff_b, public;
+SELECT ff_call('ff_target');
+-- dropped and created again
+DROP FUNCTION ff_b.ff_target();
+SELECT ff_call('ff_target');
+CREATE FUNCTION ff_b.ff_target() RETURNS text AS $$ return 'b again' $$ LANGUAGE plv8;
+SELECT ff_call('ff_target()');
+-- EXECUTE revoked and granted, directly or through a role
+CREATE ROLE ff_user;
+CREATE ROLE ff_group;
+GRANT USAGE ON SCHEMA ff_a, ff_b TO ff_user;
+REVOKE EXECUTE ON FUNCTION ff_b.ff_target() FROM PUBLIC;
+SET ROLE TO ff_user;
+SELECT ff_call('ff_target');
+RESET ROLE;
+GRANT EXECUTE ON FUNCTION ff_b.ff_target() TO ff_group;
+GRANT ff_group TO ff_user;
+SET ROLE TO ff_user;
+SELECT ff_call('ff_target');
+RESET ROLE;
+REVOKE ff_group FROM ff_user;
+SET ROLE TO ff_user;
+SELECT ff_call('ff_target');
+RESET ROLE;
+GRANT EXECUTE ON FUNCTION ff_b.ff_target() TO ff_user;
+SET ROLE TO ff_user;
+SELECT ff_call('ff_target');
+RESET ROLE;
+REVOKE EXECUTE ON FUNCTION ff_b.ff_target() FROM ff_user;
+SET ROLE TO ff_user;
+SELECT ff_call('ff_target');
+RESET ROLE;
+RESET search_path;
+DROP FUNCTION ff_call(text);
+DROP FUNCTION ff_a.ff_target();
+DROP FUNCTION ff_b.ff_target();
+DROP SCHEMA ff_a;
+DROP SCHEMA ff_b;
+DROP ROLE ff_user;
+DROP ROLE ff_group;
@@ -0,0 +1,48 @@
+-- compiled function cache limits and pinning
+SET plv8.function_cache_size = 2;
+CREATE FUNCTION fc_a() RETURNS int AS $$ return 1 $$ LANGUAGE plv8;
+CREATE FUNCTION fc_b() RETURNS int AS $$ return 1 $$ LANGUAGE plv8;
+CREATE FUNCTION fc_c() RETURNS int AS $$ return 1 $$ LANGUAGE plv8;
+SELECT fc_a();
+SELECT fc_b();
+SELECT fc_b();
+SELECT (c->>'functions')::int AS functions, (c->>'pinned')::int AS pinned, (c->>'code_size')::int AS code_size,
+       (c->>'evicted')::int AS evicted, (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM plv8_function_cache() c;
+-- pinned functions stay compiled
+SET plv8.pinned_functions = 'fc_a';
+SELECT fc_c();
+SELECT fc_a();
+SELECT fc_b();
+SELECT fc_c();
+SELECT (c->>'functions')::int AS functions, (c->>'pinned')::int AS pinned, (c->>'code_size')::int AS code_size,
+       (c->>'evicted')::int AS evicted, (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM plv8_function_cache() c;
+-- changed functions are released at once and compiled again, the others are not
+CREATE OR REPLACE FUNCTION fc_c() RETURNS int AS $$ return 2 $$ LANGUAGE plv8;
+SELECT (c->>'functions')::int AS functions, (c->>'pinned')::int AS pinned, (c->>'code_size')::int AS code_size,
+       (c->>'evicted')::int AS evicted, (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM plv8_function_cache() c;
+SELECT fc_c();
+SELECT fc_a();
+SELECT (c->>'functions')::int AS functions, (c->>'pinned')::int AS pinned, (c->>'code_size')::int AS code_size,
+       (c->>'evicted')::int AS evicted, (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM plv8_function_cache() c;
+-- only the listed overload is pinned
+CREATE FUNCTION fc_a(int) RETURNS int AS $$ return 3 $$ LANGUAGE plv8;
+SET plv8.pinned_functions = 'fc_a(), fc_b';
+SELECT fc_a(1);
+SELECT fc_b();
+SELECT (c->>'functions')::int AS functions, (c->>'pinned')::int AS pinned, (c->>'code_size')::int AS code_size,
+       (c->>'evicted')::int AS evicted, (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM plv8_function_cache() c;
+RESET plv8.pinned_functions;
+RESET plv8.function_cache_size;
+DROP FUNCTION fc_a();
+DROP FUNCTION fc_a(int);
+DROP FUNCTION fc_b();
+DROP FUNCTION fc_c();
+-- dropped functions are released
+SELECT (c->>'functions')::int AS functions, (c->>'pinned')::int AS pinned, (c->>'code_size')::int AS code_size,
+       (c->>'evicted')::int AS evicted, (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM plv8_function_cache() c;
@@ -0,0 +1,3 @@
+-- the statistics live in shared memory, set up when plv8 is preloaded
+SELECT * FROM plv8_function_stats();
+SELECT funcname, calls FROM pg_stat_plv8_functions;
@@ -0,0 +1,73 @@
+-- plv8.HashMap
+CREATE FUNCTION hashmap_basic() RETURNS json AS $$
+  var m = plv8.HashMap('text', 'int4');
+  m.set('a', 1).set('b', 2);
+  m.set('a', 3);
+  m.set('c', null);
+  var res = [m.size, m.get('a'), m.get('b'), m.get('c'), m.get('x'),
+             m.has('c'), m.has('x'), m.delete('b'), m.delete('b'), m.size,
+             String(m)];
+  m.clear();
+  res.push(m.size);
+  return res;
+$$ LANGUAGE plv8;
+SELECT hashmap_basic();
+
+CREATE FUNCTION hashmap_bulk(n int) RETURNS json AS $$
+  var keys = new Int32Array(n);
+  var values = new Float64Array(n);
+  for (var i = 0; i < n; i++) {
+    keys[i] = i;
+    values[i] = i / 2;
+  }
+  var m = plv8.HashMap('int4', 'float8');
+  m.setMany(keys, values);
+  m.setMany([n, n + 1], [-1, -2]);
+  var got = m.getMany(new Int32Array([0, 3, n - 1, n + 1, n + 5]));
+  var sum = 0;
+  m.forEach(function(v, k) { sum += v; });
+  return [m.size, got, sum];
+$$ LANGUAGE plv8;
+SELECT hashmap_bulk(100000);
+
+CREATE FUNCTION hashmap_errors() RETURNS json AS $$
+  var res = [];
+  function attempt(f) {
+    try { f(); res.push('ok'); } catch (e) { res.push(e.message); }
+  }
+  var m = plv8.HashMap('int4', 'json');
+  m.set(1, {a: [1, 2]});
+  res.push(m.get(1));
+  attempt(function() { m.set(null, 1); });
+  attempt(function() { m.setMany([1, 2], [1]); });
+  attempt(function() { m.forEach(function() { m.delete(1); }); });
+  attempt(function() { m.forEach(function() { throw new Error('stop'); }); });
+  attempt(function() { m.clear(); });
+  attempt(function() { plv8.HashMap('int4'); });
+  attempt(function() { plv8.HashMap('no_such_type', 'int4'); });
+  attempt(function() { plv8.HashMap('json', 'int4'); });
+  return res;
+$$ LANGUAGE plv8;
+SELECT hashmap_errors();
+
+-- a failed conversion ends the forEach() scan
+CREATE FUNCTION hashmap_convert_error() RETURNS json AS $$
+  var res = [];
+  var m = plv8.HashMap('int4', 'plv8_int4array');
+  m.set(1, [1, null]);
+  try { m.forEach(function() {}); } catch (e) { res.push(e.message); }
+  res.push(m.delete(1), m.size);
+  return res;
+$$ LANGUAGE plv8;
+SELECT hashmap_convert_error();
+
+-- size read through another receiver
+CREATE FUNCTION hashmap_receiver() RETURNS json AS $$
+  var res = [];
+  var m = plv8.HashMap('int4', 'int4');
+  m.set(1, 1);
+  try { res.push(Object.create(m).size); } catch (e) { res.push(e.name + ': ' + e.message); }
+  res.push(m.size);
+  return res;
+$$ LANGUAGE plv8;
+SELECT hashmap_receiver();
@@ -0,0 +1,17 @@
+-- a call running into the heap limit fails, and the next one runs on the same runtime
+CREATE FUNCTION heap_limit_hog() RETURNS int AS $$
+  const a = [];
+  while (true) a.push({ n: a.length });
+$$ LANGUAGE plv8;
+DO $$ globalThis.kept = 42 $$ LANGUAGE plv8;
+SELECT heap_limit_hog();
+DO $$ plv8.elog(NOTICE, globalThis.kept) $$ LANGUAGE plv8;
+SELECT (i->>'heap_limit_recovered')::int AS recovered, (i->>'heap_limit_killed')::int AS killed
+  FROM (SELECT plv8_info()->0 AS i) s;
+SELECT (c->>'runtimes')::int AS runtimes, (c->>'created')::int AS created
+  FROM plv8_runtime_cache() c;
+-- the heap limit is lowered again
+SELECT heap_limit_hog();
+SELECT (i->>'heap_limit_recovered')::int AS recovered, (i->>'heap_limit_killed')::int AS killed
+  FROM (SELECT plv8_info()->0 AS i) s;
+DROP FUNCTION heap_limit_hog();
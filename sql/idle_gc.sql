@@ -0,0 +1,18 @@
+-- GC at the first call after the backend was idle
+DO $$ const a = []; for (let i = 0; i < 100000; i++) a.push({ i }); $$ LANGUAGE plv8;
+SELECT pg_sleep(0.2);
+DO $$ plv8.elog(NOTICE, 'collected') $$ LANGUAGE plv8;
+
+-- user contexts unused for plv8.context_idle_timeout are disposed of, except
+-- the one the call uses
+SET plv8.context_idle_timeout = 1;
+SET plv8.context = 'idle_a';
+DO $$ plv8.elog(NOTICE, 'idle_a') $$ LANGUAGE plv8;
+SET plv8.context = 'idle_b';
+DO $$ plv8.elog(NOTICE, 'idle_b') $$ LANGUAGE plv8;
+SELECT pg_sleep(1.1);
+DO $$ plv8.elog(NOTICE, 'idle_b') $$ LANGUAGE plv8;
+RESET plv8.context;
+SELECT context FROM plv8_runtime_stats() WHERE context LIKE 'idle_%' ORDER BY context;
+SELECT context, evicted FROM plv8_context_stats WHERE context LIKE 'idle_%' ORDER BY context;
+RESET plv8.context_idle_timeout;
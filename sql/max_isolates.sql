@@ -0,0 +1,25 @@
+-- per-user isolates beyond plv8.max_isolates dispose of the least recently used
+SET plv8.max_isolates = 2;
+CREATE ROLE iso_a;
+CREATE ROLE iso_b;
+DO $$ plv8.elog(NOTICE, 'superuser') $$ LANGUAGE plv8;
+SET ROLE TO iso_a;
+DO $$ plv8.elog(NOTICE, 'iso_a') $$ LANGUAGE plv8;
+SET ROLE TO iso_b;
+DO $$ plv8.elog(NOTICE, 'iso_b') $$ LANGUAGE plv8;
+RESET ROLE;
+SELECT (c->>'runtimes')::int AS runtimes, (c->>'max_isolates')::int AS max_isolates,
+       (c->>'created')::int AS created, (c->>'evicted')::int AS evicted,
+       (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM plv8_runtime_cache() c;
+DO $$ plv8.elog(NOTICE, 'superuser') $$ LANGUAGE plv8;
+SET ROLE TO iso_b;
+DO $$ plv8.elog(NOTICE, 'iso_b') $$ LANGUAGE plv8;
+RESET ROLE;
+SELECT (c->>'runtimes')::int AS runtimes, (c->>'max_isolates')::int AS max_isolates,
+       (c->>'created')::int AS created, (c->>'evicted')::int AS evicted,
+       (c->>'hits')::int AS hits, (c->>'misses')::int AS misses
+  FROM plv8_runtime_cache() c;
+RESET plv8.max_isolates;
+DROP ROLE iso_a;
+DROP ROLE iso_b;
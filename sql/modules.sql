@@ -0,0 +1,27 @@
+INSERT INTO plv8_es_modules VALUES
+  ('math', 'export function add(a, b) { return a + b; }'),
+  ('greet', 'import { add } from "math";
+export const answer = add(40, 2);
+export default function (name) { return "hello " + name; }');
+
+CREATE FUNCTION module_answer() RETURNS int AS $$
+  return plv8.import('greet').answer;
+$$ LANGUAGE plv8;
+CREATE FUNCTION module_hello(name text) RETURNS text AS $$
+  return plv8.import('greet').default(name);
+$$ LANGUAGE plv8;
+
+SELECT module_answer();
+SELECT module_hello('world');
+
+-- changed modules are compiled again
+UPDATE plv8_es_modules SET source = 'export function add(a, b) { return a * b; }' WHERE name = 'math';
+SELECT module_answer();
+
+CREATE FUNCTION module_missing() RETURNS int AS $$ return plv8.import('nope'); $$ LANGUAGE plv8;
+SELECT module_missing();
+
+DROP FUNCTION module_answer();
+DROP FUNCTION module_hello(text);
+DROP FUNCTION module_missing();
+DELETE FROM plv8_es_modules;
@@ -0,0 +1,32 @@
+CREATE FUNCTION profiled(n int) RETURNS int AS $$
+  let sum = 0;
+  for (let i = 0; i < n; i++)
+    sum += i % 7;
+  return sum;
+$$ LANGUAGE plv8;
+
+SELECT plv8_profile_stop();
+SELECT plv8_profile_start(10);
+SELECT plv8_profile_start();
+SELECT profiled(100000);
+SELECT p->'nodes'->0->'callFrame'->>'functionName' AS root,
+       json_array_length(p->'samples') = json_array_length(p->'timeDeltas') AS samples
+  FROM (SELECT plv8_profile_stop()::json AS p) profile;
+SELECT plv8_profile_stop();
+
+SELECT plv8_profile_start(0);
+SELECT plv8_profile_start();
+SELECT plv8_profile_stop('../profile');
+SELECT plv8_profile_stop('profile.cpuprofile');
+SELECT plv8_profile_remove('profile.cpuprofile');
+SELECT plv8_profile_remove('profile.cpuprofile');
+SELECT plv8_profile_remove('../profile');
+
+-- one profile at a time
+CREATE FUNCTION nested_start() RETURNS void AS $$ plv8.execute('SELECT plv8_profile_start()') $$ LANGUAGE plv8;
+SET plv8.profile_min_duration = 1000000;
+SELECT nested_start();
+RESET plv8.profile_min_duration;
+
+DROP FUNCTION nested_start();
+DROP FUNCTION profiled(int);
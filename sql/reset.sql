@@ -11,3 +11,24 @@ SELECT test_context_value();
 
 SELECT plv8_reset();
 SELECT test_context_value();
+
+SELECT set_context_value('again');
+SELECT plv8_reset_contexts();
+SELECT test_context_value();
+
+-- from JS, the reset waits for the end of the transaction
+CREATE OR REPLACE FUNCTION reset_from_js() RETURNS text as $V8$
+    plv8.execute('SELECT plv8_reset_contexts()');
+    return ctx_value;
+$V8$ LANGUAGE plv8;
+SELECT set_context_value('deferred');
+SELECT reset_from_js();
+SELECT test_context_value();
+DROP FUNCTION reset_from_js();
+
+-- functions called again in the same query are looked up again
+CREATE FUNCTION reset_between_rows() RETURNS int AS $V8$
+    return 1;
+$V8$ LANGUAGE plv8;
+SELECT reset_between_rows(), plv8_reset_contexts() FROM generate_series(1, 2);
+DROP FUNCTION reset_between_rows();
@@ -0,0 +1,36 @@
+-- roles of plv8.shared_isolate_roles share the runtime of the first one
+CREATE ROLE sir_owner;
+CREATE ROLE sir_reader;
+CREATE ROLE sir_other;
+CREATE FUNCTION sir_tag() RETURNS text AS $$ return globalThis.tag || 'none' $$ LANGUAGE plv8;
+SET plv8.shared_isolate_roles = 'sir_owner, sir_reader';
+SET ROLE TO sir_owner;
+DO $$ globalThis.tag = 'sir_owner' $$ LANGUAGE plv8;
+SET ROLE TO sir_reader;
+SELECT sir_tag();
+SET ROLE TO sir_other;
+SELECT sir_tag();
+DO $$ globalThis.tag = 'sir_other' $$ LANGUAGE plv8;
+RESET ROLE;
+DO $$ globalThis.tag = 'superuser' $$ LANGUAGE plv8;
+-- SECURITY DEFINER functions run in the runtime of their owner
+CREATE FUNCTION sir_definer_tag() RETURNS text AS $$ return globalThis.tag || 'none' $$ LANGUAGE plv8 SECURITY DEFINER;
+ALTER FUNCTION sir_definer_tag() OWNER TO sir_reader;
+SELECT sir_tag(), sir_definer_tag() FROM generate_series(1, 2);
+-- a call site follows the user and the runtimes it runs with
+BEGIN;
+DECLARE sir_cur CURSOR FOR SELECT sir_tag() FROM generate_series(1, 4);
+FETCH 1 FROM sir_cur;
+SET LOCAL ROLE TO sir_other;
+FETCH 1 FROM sir_cur;
+RESET ROLE;
+FETCH 1 FROM sir_cur;
+SELECT plv8_reset();
+FETCH 1 FROM sir_cur;
+COMMIT;
+RESET plv8.shared_isolate_roles;
+DROP FUNCTION sir_definer_tag();
+DROP FUNCTION sir_tag();
+DROP ROLE sir_owner;
+DROP ROLE sir_reader;
+DROP ROLE sir_other;
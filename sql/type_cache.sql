@@ -0,0 +1,31 @@
+-- cached type information follows changes of domains and enums
+CREATE DOMAIN tc_small AS int;
+CREATE FUNCTION tc_domain(v int) RETURNS tc_small AS $$ return v $$ LANGUAGE plv8;
+SELECT tc_domain(1000);
+ALTER DOMAIN tc_small ADD CONSTRAINT tc_small_check CHECK (VALUE < 100);
+SELECT tc_domain(1000);
+SELECT tc_domain(10);
+ALTER DOMAIN tc_small DROP CONSTRAINT tc_small_check;
+SELECT tc_domain(1000);
+CREATE TYPE tc_mood AS ENUM ('sad', 'ok');
+CREATE FUNCTION tc_enum(m text) RETURNS tc_mood AS $$ return m $$ LANGUAGE plv8;
+CREATE FUNCTION tc_enum_arg(m tc_mood) RETURNS text AS $$ return typeof m + ' ' + m $$ LANGUAGE plv8;
+SELECT tc_enum('ok');
+SELECT tc_enum('happy');
+ALTER TYPE tc_mood ADD VALUE 'happy';
+SELECT tc_enum('happy');
+SELECT tc_enum_arg('happy');
+-- a type dropped and created again under the same name
+DROP FUNCTION tc_enum(text);
+DROP FUNCTION tc_enum_arg(tc_mood);
+DROP TYPE tc_mood;
+CREATE TYPE tc_mood AS (level int);
+CREATE FUNCTION tc_enum(m text) RETURNS tc_mood AS $$ return { level: m.length } $$ LANGUAGE plv8;
+CREATE FUNCTION tc_enum_arg(m tc_mood) RETURNS text AS $$ return typeof m + ' ' + m.level $$ LANGUAGE plv8;
+SELECT tc_enum('happy');
+SELECT tc_enum_arg(ROW(3)::tc_mood);
+DROP FUNCTION tc_enum(text);
+DROP FUNCTION tc_enum_arg(tc_mood);
+DROP TYPE tc_mood;
+DROP FUNCTION tc_domain(int);
+DROP DOMAIN tc_small;
@@ -0,0 +1,21 @@
+-- the validator does not run plv8.start_proc
+CREATE FUNCTION validator_start() RETURNS void AS $$
+  plv8.elog(NOTICE, 'start_proc');
+$$ LANGUAGE plv8;
+SET plv8.start_proc = 'validator_start';
+CREATE FUNCTION validated() RETURNS int AS $$
+  return 1;
+$$ LANGUAGE plv8;
+SELECT validated();
+RESET plv8.start_proc;
+
+-- bodies are not checked with check_function_bodies off
+CREATE FUNCTION not_validated() RETURNS text AS '@' LANGUAGE plv8;
+SET check_function_bodies = off;
+CREATE FUNCTION not_validated() RETURNS text AS '@' LANGUAGE plv8;
+RESET check_function_bodies;
+SELECT not_validated();
+
+DROP FUNCTION not_validated();
+DROP FUNCTION validated();
+DROP FUNCTION validator_start();
@@ -0,0 +1,9 @@
+-- compile functions ahead of their first call
+CREATE SCHEMA warm;
+CREATE FUNCTION warm.wf_a() RETURNS int AS $$ return 1 $$ LANGUAGE plv8;
+CREATE FUNCTION warm.wf_b(x int) RETURNS int AS $$ return x + 1 $$ LANGUAGE plv8;
+CREATE FUNCTION warm.wf_sql() RETURNS int AS $$ SELECT 1 $$ LANGUAGE sql;
+SELECT plv8_warmup(ARRAY['warm.wf_a()', 'warm.wf_sql()']::regprocedure[]);
+SELECT plv8_warmup('warm');
+SELECT warm.wf_b(1);
+DROP SCHEMA warm CASCADE;